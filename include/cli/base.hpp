@@ -22,19 +22,35 @@
 #ifndef BASE_HPP_
 #define BASE_HPP_
 
+#include <cerrno>
+#include <cstddef>
+#include <exception>
+#include <functional>
 #include <iostream>
 #include <string>
+#include <system_error>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
+#include <boost/algorithm/string/join.hpp>
 #include <boost/function.hpp>
 #include <boost/shared_ptr.hpp>
 
 #include <cli/callbacks.hpp>
+#include <cli/conversion.hpp>
+#include <cli/memoize.hpp>
 #include <cli/readline.hpp>
+#include <cli/script.hpp>
 #include <cli/traits.hpp>
 #include <cli/utility.hpp>
 
 #include <cli/detail/utility.hpp>
 
+#include <unistd.h>
+
 namespace cli
 {
     //
@@ -90,6 +106,82 @@ namespace cli
             void loop();
             bool interpretOneLine(std::string line);
 
+            //
+            // Interpret every line of a script file without prompting or
+            // adding them to the history. It returns true if a command
+            // asked to finish the interpreter. std::system_error is thrown
+            // if the file can not be read.
+            //
+
+            bool runScript(const std::string& fileName);
+
+            //
+            // Members to run the interpreter inside an external event loop.
+            // onReadable() must be invoked when 'fd' is readable. If it is
+            // inputDescriptor(), the line is edited through readline, when
+            // available. Otherwise the data read is passed to feed(), which
+            // interprets the complete lines and keeps the rest until more
+            // data arrives. They return true when a command asked to finish
+            // the interpreter or the input ended.
+            //
+
+            void startInput();
+            bool onReadable(int fd);
+            bool feed(const std::string& data);
+            void stopInput();
+
+            int inputDescriptor() const
+                { return readLine_.inDescriptor(); }
+
+            //
+            // Maximum length of the incomplete line kept by onReadable()
+            // and feed() until its newline arrives. If it is exceeded, the
+            // line is discarded and they throw std::system_error.
+            //
+
+            static const std::size_t DEFAULT_MAX_LINE_LENGTH = 1024 * 1024;
+
+            void maxLineLength(std::size_t length)
+                { maxLineLength_ = length; }
+            std::size_t maxLineLength() const
+                { return maxLineLength_; }
+
+            //
+            // Streams given to the constructor. Commands must write in
+            // them, instead of std::cout and std::cerr, so their output
+            // goes wherever the interpreter writes, e.g. to the client of
+            // a ShellServer session.
+            //
+
+            std::ostream& out() const
+                { return out_; }
+            std::ostream& err() const
+                { return err_; }
+
+            //
+            // In concurrent mode interpretOneLine() can be invoked from
+            // several threads at the same time. Commands can still be
+            // registered at any time, but the rest of callbacks must be
+            // set before. lastCommand() is not updated in this mode.
+            //
+
+            void concurrentMode(bool isEnabled)
+                { isConcurrentMode_ = isEnabled; }
+            bool isConcurrentMode() const
+                { return isConcurrentMode_; }
+
+            //
+            // In prefetch mode runScript() reads and parses the script in
+            // another thread, ahead of the commands run by the calling
+            // thread. joinLine(), preRunCommand() and isParseDeferred() are
+            // invoked from that thread. It is ignored in concurrent mode.
+            //
+
+            void prefetchMode(bool isEnabled)
+                { isPrefetchMode_ = isEnabled; }
+            bool isPrefetchMode() const
+                { return isPrefetchMode_; }
+
             //
             // Members to manage the command history
             //
@@ -99,6 +191,11 @@ namespace cli
 
             void historyFile(const std::string& fileName);
 
+            cli::history::HistoryStore* historyStore() const
+                { return readLine_.historyStore(); }
+            void historySearchKey(const std::string& keySequence)
+                { readLine_.bindHistorySearch(keySequence); }
+
             //
             // Members to configure the user interface
             //
@@ -107,6 +204,8 @@ namespace cli
                 { introText_ = intro; }
             void promptText(const std::string& prompt)
                 { promptText_ = prompt; }
+            void continuationPromptText(const std::string& prompt)
+                { continuationPromptText_ = prompt; }
 
             //
             // Accessors of callback functions
@@ -114,12 +213,62 @@ namespace cli
 
             cli::callback::RunCommandCallback<ParserType> onRunCommand;
             cli::callback::ParseErrorCallback<ParserType> onParseError;
+            cli::callback::UnknownCommandCallback onUnknownCommand;
             cli::callback::EmptyLineCallback onEmptyLine;
             cli::callback::PreRunCommandCallback onPreRunCommand;
             cli::callback::PostRunCommandCallback onPostRunCommand;
             cli::callback::PreLoopCallback onPreLoop;
             cli::callback::PostLoopCallback onPostLoop;
 
+            //
+            // Names similar to 'command' among the commands registered and
+            // the names added with onRunCommand.addSuggestions(). Unknown
+            // commands without a default callback are reported with them,
+            // so a default callback should do the same for the commands
+            // it does not know.
+            //
+
+            std::vector<std::string> suggestions(
+                const std::string& command) const
+                { return onRunCommand.suggestions(command); }
+
+            //
+            // Register a callback function whose arguments are converted
+            // from the command words to the types specified as template
+            // arguments. E.g.:
+            //
+            //  interpreter.registerCommand<int, std::string>("name",
+            //      [](int n, std::string s) { ...; return false; });
+            //
+            // Arguments that can not be converted are reported through
+            // parseError() and the callback function is not invoked.
+            //
+
+            template <typename... Types>
+            void registerCommand(const std::string& command,
+                const boost::function<typename cli::conversion::
+                    CommandSignature<Types...>::Type>& callback);
+
+            //
+            // Register a callback function without side effects. Its return
+            // value and the output written in the output stream are kept in
+            // resultCache(), so later invocations with the same arguments
+            // replay them without invoking the callback. The results are
+            // discarded when any file in 'dependencies' is modified.
+            // The cache is bypassed in concurrent mode.
+            //
+
+            void registerCacheableCommand(const std::string& command,
+                const boost::function<typename cli::callback::
+                    RunCommandCallback<Parser>::Signature>& callback,
+                const std::vector<std::string>& dependencies =
+                    std::vector<std::string>());
+
+            cli::memoize::ResultCache& resultCache()
+                { return resultCache_; }
+            const cli::memoize::ResultCache& resultCache() const
+                { return resultCache_; }
+
         private:
             std::istream& in_;
             std::ostream& out_;
@@ -129,6 +278,48 @@ namespace cli
             std::string introText_;
             std::string promptText_;
             std::string lastCommand_;
+            bool isConcurrentMode_;
+            bool isPrefetchMode_;
+            cli::memoize::ResultCache resultCache_;
+
+            std::string pendingInput_;
+            bool isInputStarted_;
+            std::size_t maxLineLength_;
+
+            // Command which continues in the next line
+            std::string continuationPromptText_;
+            bool isLinePending_;
+
+            // Line being interpreted by the current thread
+            static thread_local const std::string* currentLine_;
+
+            // Restore the previous line on destruction, because commands
+            // could interpret other lines recursively
+            struct CurrentLineGuard
+            {
+                const std::string* previous;
+
+                CurrentLineGuard(const std::string& line)
+                    : previous(currentLine_)
+                    { currentLine_ = &line; }
+                ~CurrentLineGuard()
+                    { currentLine_ = previous; }
+            };
+
+            // Line of a script read and parsed ahead by prefetchScript()
+            struct ParsedLine
+            {
+                std::string line;
+                bool isEnd;
+                bool isEmpty;
+                bool isDeferred;
+                std::vector<std::pair<std::string, CommandArgumentsType> >
+                    commands;
+                bool isError;
+                ParseErrorType error;
+            };
+
+            typedef cli::script::PrefetchRing<ParsedLine> PrefetchRingType;
 
             boost::shared_ptr<Parser> parserObject_;
             boost::function<ParserSignature> parser_;
@@ -139,6 +330,7 @@ namespace cli
 
             virtual bool runCommand(const std::string& command,
                 CommandArgumentsType const& arguments);
+            virtual bool unknownCommand(const std::string& command);
             virtual bool emptyLine();
 
             //
@@ -157,6 +349,41 @@ namespace cli
 
             virtual void preLoop();
             virtual void postLoop();
+
+            //
+            // Hook method invoked for every line read. It returns false if
+            // the command continues in the next line, so the line must be
+            // kept until the command is complete. Then the whole command is
+            // returned in 'line'. If 'isLastLine' is true, it must return
+            // the command even if it is incomplete.
+            //
+
+            virtual bool joinLine(std::string& line, bool isLastLine)
+                { return true; }
+
+            //
+            // Hook method invoked in prefetch mode. It returns true if the
+            // line must not be parsed ahead, because it could be parsed
+            // differently after running the previous commands.
+            //
+
+            virtual bool isParseDeferred(const std::string& line) const
+                { return false; }
+
+            bool interpretLine(std::string& line, bool isLastLine = false);
+            bool interpretPendingInput();
+            bool interpretIncompleteLine();
+            void reportHistoryError();
+
+            bool parseAndRunCommands(const std::string& line);
+            bool runParsedCommand(const std::string& command,
+                CommandArgumentsType const& arguments,
+                const std::string& line);
+
+            bool runPrefetchedScript(const std::string& fileName);
+            void prefetchScript(const cli::script::MappedFile& script,
+                PrefetchRingType& ring, std::exception_ptr& exception);
+            bool interpretParsedLine(ParsedLine& parsed);
     };
 
     template <typename Parser>
@@ -166,6 +393,12 @@ namespace cli
           out_(std::cout),
           err_(std::cerr),
           readLine_(useReadline),
+          isConcurrentMode_(false),
+          isPrefetchMode_(false),
+          isInputStarted_(false),
+          maxLineLength_(DEFAULT_MAX_LINE_LENGTH),
+          continuationPromptText_("> "),
+          isLinePending_(false),
           parserObject_(new Parser),
           parser_(*parserObject_)
     {}
@@ -178,9 +411,18 @@ namespace cli
           out_(out),
           err_(err),
           readLine_(useReadline),
+          isConcurrentMode_(false),
+          isPrefetchMode_(false),
+          isInputStarted_(false),
+          maxLineLength_(DEFAULT_MAX_LINE_LENGTH),
+          continuationPromptText_("> "),
+          isLinePending_(false),
           parserObject_(new Parser),
           parser_(*parserObject_)
-    {}
+    {
+        readLine_.inStream(in);
+        readLine_.outStream(out);
+    }
 
     template <typename Parser>
     CommandLineInterpreterBase<Parser>::CommandLineInterpreterBase(
@@ -189,6 +431,12 @@ namespace cli
           out_(std::cout),
           err_(std::cerr),
           readLine_(useReadline),
+          isConcurrentMode_(false),
+          isPrefetchMode_(false),
+          isInputStarted_(false),
+          maxLineLength_(DEFAULT_MAX_LINE_LENGTH),
+          continuationPromptText_("> "),
+          isLinePending_(false),
           parser_(parser)
     {}
 
@@ -200,8 +448,17 @@ namespace cli
           out_(out),
           err_(err),
           readLine_(useReadline),
+          isConcurrentMode_(false),
+          isPrefetchMode_(false),
+          isInputStarted_(false),
+          maxLineLength_(DEFAULT_MAX_LINE_LENGTH),
+          continuationPromptText_("> "),
+          isLinePending_(false),
           parser_(parser)
-    {}
+    {
+        readLine_.inStream(in);
+        readLine_.outStream(out);
+    }
 
     template <typename Parser>
     CommandLineInterpreterBase<Parser>::CommandLineInterpreterBase(
@@ -210,6 +467,12 @@ namespace cli
           out_(std::cout),
           err_(std::cerr),
           readLine_(useReadline),
+          isConcurrentMode_(false),
+          isPrefetchMode_(false),
+          isInputStarted_(false),
+          maxLineLength_(DEFAULT_MAX_LINE_LENGTH),
+          continuationPromptText_("> "),
+          isLinePending_(false),
           parserObject_(parser),
           parser_(*parser)
     {}
@@ -222,9 +485,22 @@ namespace cli
           out_(out),
           err_(err),
           readLine_(useReadline),
+          isConcurrentMode_(false),
+          isPrefetchMode_(false),
+          isInputStarted_(false),
+          maxLineLength_(DEFAULT_MAX_LINE_LENGTH),
+          continuationPromptText_("> "),
+          isLinePending_(false),
           parserObject_(parser),
           parser_(*parser)
-    {}
+    {
+        readLine_.inStream(in);
+        readLine_.outStream(out);
+    }
+
+    template <typename Parser>
+    thread_local const std::string*
+    CommandLineInterpreterBase<Parser>::currentLine_ = nullptr;
 
     template <typename Parser>
     void CommandLineInterpreterBase<Parser>::loop()
@@ -234,16 +510,22 @@ namespace cli
         preLoop();
 
         std::string promptText;
+        std::string continuationPromptText;
         if (isStreamTty(in_) && isStreamTty(out_)) {
             out_ << introText_ << std::endl;
             promptText = promptText_;
+            continuationPromptText = continuationPromptText_;
         }
 
         std::string line;
         while (true) {
-            bool isOk = readLine_.readLine(line, promptText);
-            if (! isOk)
+            bool isOk = readLine_.readLine(line,
+                isLinePending_ ? continuationPromptText : promptText);
+            reportHistoryError();
+            if (! isOk) {
+                interpretIncompleteLine();
                 break;
+            }
             bool isFinished = interpretOneLine(line);
             if (isFinished)
                 break;
@@ -256,15 +538,199 @@ namespace cli
     bool CommandLineInterpreterBase<Parser>::interpretOneLine(
         std::string line)
     {
+        return interpretLine(line);
+    }
+
+    //
+    // The lines read are interpreted even if they could not be written in
+    // the history file, so the error is only reported
+    //
+
+    template <typename Parser>
+    void CommandLineInterpreterBase<Parser>::reportHistoryError()
+    {
+        std::string error = readLine_.takeHistoryError();
+        if (! error.empty()) {
+            err_ << cli::utility::programShortName()
+                 << ": "
+                 << error
+                 << std::endl;
+        }
+    }
+
+    template <typename Parser>
+    bool CommandLineInterpreterBase<Parser>::runScript(
+        const std::string& fileName)
+    {
+        if (isPrefetchMode_ && ! isConcurrentMode_) {
+            return runPrefetchedScript(fileName);
+        }
+
+        cli::script::MappedFile script(fileName);
+        cli::script::LineSplitter lines(script.begin(), script.end());
+
+        // The parser works on std::string, so every line is copied into the
+        // same buffer to avoid allocating memory once it is big enough
+        std::string line;
+        const char* begin;
+        const char* end;
+        while (lines.nextLine(begin, end)) {
+            line.assign(begin, end);
+            bool isFinished = interpretLine(line);
+            if (isFinished)
+                return true;
+        }
+        return interpretIncompleteLine();
+    }
+
+    template <typename Parser>
+    void CommandLineInterpreterBase<Parser>::startInput()
+    {
+        using utility::detail::isStreamTty;
+
+        preLoop();
+        isInputStarted_ = true;
+
+        std::string promptText;
+        std::string continuationPromptText;
+        if (isStreamTty(in_) && isStreamTty(out_)) {
+            out_ << introText_ << std::endl;
+            promptText = promptText_;
+            continuationPromptText = continuationPromptText_;
+        }
+
+        readLine_.startReading(promptText, [this, promptText,
+            continuationPromptText](const std::string& line)
+        {
+            std::string copy(line);
+            bool isFinished = interpretLine(copy);
+            readLine_.prompt(isLinePending_ ? continuationPromptText :
+                promptText);
+            return isFinished;
+        });
+    }
+
+    template <typename Parser>
+    bool CommandLineInterpreterBase<Parser>::onReadable(int fd)
+    {
+        if (fd == inputDescriptor()) {
+            bool isOk = readLine_.readAvailable();
+            reportHistoryError();
+            if (! isOk) {
+                interpretIncompleteLine();
+                stopInput();
+            }
+            return ! isOk;
+        }
+
+        // The read buffer is shared by all the interpreters used by the
+        // thread, so idle interpreters only keep their incomplete lines
+        static thread_local char buffer[64 * 1024];
+        ssize_t count = ::read(fd, buffer, sizeof(buffer));
+
+        if (count == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                return false;
+            }
+            throw std::system_error(errno, std::system_category(),
+                "unexpected error reading command input");
+        }
+        else if (count == 0) {
+            // The last line may not end with a newline
+            if (! pendingInput_.empty()) {
+                std::string line;
+                line.swap(pendingInput_);
+                interpretLine(line, true);
+            }
+            else {
+                interpretIncompleteLine();
+            }
+            return true;
+        }
+        pendingInput_.append(buffer, count);
+        return interpretPendingInput();
+    }
+
+    template <typename Parser>
+    bool CommandLineInterpreterBase<Parser>::feed(const std::string& data)
+    {
+        pendingInput_ += data;
+        return interpretPendingInput();
+    }
+
+    template <typename Parser>
+    void CommandLineInterpreterBase<Parser>::stopInput()
+    {
+        readLine_.stopReading();
+        if (isInputStarted_) {
+            isInputStarted_ = false;
+            postLoop();
+        }
+    }
+
+    template <typename Parser>
+    bool CommandLineInterpreterBase<Parser>::interpretPendingInput()
+    {
+        std::string line;
+        std::string::size_type begin = 0;
+        std::string::size_type end;
+        while ((end = pendingInput_.find('\n', begin)) != std::string::npos) {
+            line.assign(pendingInput_, begin, end - begin);
+            begin = end + 1;
+            if (interpretLine(line)) {
+                pendingInput_.erase(0, begin);
+                return true;
+            }
+        }
+        pendingInput_.erase(0, begin);
+
+        if (pendingInput_.size() > maxLineLength_) {
+            pendingInput_.clear();
+            throw std::system_error(EMSGSIZE, std::system_category(),
+                "command line too long");
+        }
+        return false;
+    }
+
+    template <typename Parser>
+    bool CommandLineInterpreterBase<Parser>::interpretIncompleteLine()
+    {
+        if (! isLinePending_) {
+            return false;
+        }
+        std::string line;
+        return interpretLine(line, true);
+    }
+
+    template <typename Parser>
+    bool CommandLineInterpreterBase<Parser>::interpretLine(std::string& line,
+        bool isLastLine)
+    {
+        // Lines interpreted concurrently can not be joined
+        if (! isConcurrentMode_) {
+            isLinePending_ = ! joinLine(line, isLastLine);
+            if (isLinePending_) {
+                return false;
+            }
+        }
+
         preRunCommand(line);
 
         if (utility::detail::isLineEmpty(line)) {
             return emptyLine();
         }
-        else {
+        else if (! isConcurrentMode_) {
             lastCommand_ = line;
         }
 
+        CurrentLineGuard currentLineGuard(line);
+        return parseAndRunCommands(line);
+    }
+
+    template <typename Parser>
+    bool CommandLineInterpreterBase<Parser>::parseAndRunCommands(
+        const std::string& line)
+    {
         std::string::const_iterator begin = line.begin();
         std::string::const_iterator end = line.end();
         while (begin != end) {
@@ -273,21 +739,181 @@ namespace cli
             ParseErrorType error;
             bool success = parser_(begin, end, command, arguments, error);
 
-            bool isFinished;
             if (! success) {
-                isFinished = parseError(error, line);
-                return isFinished;
+                return parseError(error, line);
             }
-            else {
-                isFinished = runCommand(command, arguments);
-                isFinished = postRunCommand(isFinished, line);
-                if (isFinished)
-                    return true;
+            else if (runParsedCommand(command, arguments, line)) {
+                return true;
             }
         }
         return false;
     }
 
+    template <typename Parser>
+    bool CommandLineInterpreterBase<Parser>::runParsedCommand(
+        const std::string& command, CommandArgumentsType const& arguments,
+        const std::string& line)
+    {
+        bool isFinished = runCommand(command, arguments);
+        isFinished = postRunCommand(isFinished, line);
+
+        // Commands may write in buffered mode, so the output is flushed
+        // only once per command
+        out_.flush();
+        return isFinished;
+    }
+
+    //
+    // Script execution in prefetch mode
+    //
+
+    template <typename Parser>
+    bool CommandLineInterpreterBase<Parser>::runPrefetchedScript(
+        const std::string& fileName)
+    {
+        cli::script::MappedFile script(fileName);
+        PrefetchRingType ring;
+        std::exception_ptr exception;
+
+        // Stop the reader thread even if a command throws
+        struct ReaderGuard
+        {
+            PrefetchRingType& ring;
+            std::thread reader;
+
+            ReaderGuard(PrefetchRingType& ring, std::thread&& reader)
+                : ring(ring), reader(std::move(reader))
+                {}
+            ~ReaderGuard()
+                { stop(); }
+
+            void stop()
+            {
+                ring.close();
+                if (reader.joinable()) {
+                    reader.join();
+                }
+            }
+        } readerGuard(ring, std::thread(&Type::prefetchScript, this,
+            std::cref(script), std::ref(ring), std::ref(exception)));
+
+        bool isFinished = false;
+        while (! isFinished) {
+            ParsedLine* parsed = ring.popSlot();
+            if (parsed->isEnd) {
+                break;
+            }
+            isFinished = interpretParsedLine(*parsed);
+            ring.pop();
+        }
+
+        readerGuard.stop();
+        if (exception) {
+            std::rethrow_exception(exception);
+        }
+        return isFinished;
+    }
+
+    template <typename Parser>
+    void CommandLineInterpreterBase<Parser>::prefetchScript(
+        const cli::script::MappedFile& script, PrefetchRingType& ring,
+        std::exception_ptr& exception)
+    {
+        ParsedLine* parsed = NULL;
+        try {
+            cli::script::LineSplitter lines(script.begin(), script.end());
+            const char* begin;
+            const char* end;
+            bool isLastLine = false;
+            while (! isLastLine) {
+                parsed = ring.pushSlot();
+                if (parsed == NULL) {
+                    return;
+                }
+
+                // Lines are joined in the slot, so they are not copied
+                if (lines.nextLine(begin, end)) {
+                    parsed->line.assign(begin, end);
+                }
+                else {
+                    parsed->line.clear();
+                    isLastLine = true;
+                }
+                if (! joinLine(parsed->line, isLastLine)) {
+                    continue;
+                }
+                else if (isLastLine && parsed->line.empty()) {
+                    break;
+                }
+
+                preRunCommand(parsed->line);
+                parsed->isEnd = false;
+                parsed->isEmpty =
+                    utility::detail::isLineEmpty(parsed->line);
+                parsed->isDeferred = ! parsed->isEmpty &&
+                    isParseDeferred(parsed->line);
+                parsed->commands.clear();
+                parsed->isError = false;
+
+                if (! parsed->isEmpty && ! parsed->isDeferred) {
+                    std::string::const_iterator begin =
+                        parsed->line.begin();
+                    std::string::const_iterator end = parsed->line.end();
+                    while (begin != end) {
+                        parsed->commands.resize(parsed->commands.size() + 1);
+                        std::pair<std::string, CommandArgumentsType>&
+                            command = parsed->commands.back();
+                        if (! parser_(begin, end, command.first,
+                            command.second, parsed->error))
+                        {
+                            parsed->commands.pop_back();
+                            parsed->isError = true;
+                            break;
+                        }
+                    }
+                }
+                ring.push();
+            }
+            parsed = ring.pushSlot();
+        }
+        catch (...) {
+            // Reported by the consumer at the end of the script
+            exception = std::current_exception();
+            parsed = ring.pushSlot();
+        }
+
+        if (parsed != NULL) {
+            parsed->isEnd = true;
+            ring.push();
+        }
+    }
+
+    template <typename Parser>
+    bool CommandLineInterpreterBase<Parser>::interpretParsedLine(
+        ParsedLine& parsed)
+    {
+        if (parsed.isEmpty) {
+            return emptyLine();
+        }
+        lastCommand_ = parsed.line;
+
+        CurrentLineGuard currentLineGuard(parsed.line);
+        if (parsed.isDeferred) {
+            return parseAndRunCommands(parsed.line);
+        }
+
+        for (typename std::vector<std::pair<std::string,
+            CommandArgumentsType> >::const_iterator i =
+            parsed.commands.begin(); i < parsed.commands.end(); ++i)
+        {
+            if (runParsedCommand(i->first, i->second, parsed.line)) {
+                return true;
+            }
+        }
+        return parsed.isError ? parseError(parsed.error, parsed.line) :
+            false;
+    }
+
     template <typename Parser>
     void CommandLineInterpreterBase<Parser>::historyFile(
         const std::string& fileName)
@@ -296,11 +922,114 @@ namespace cli
         readLine_.historyFile(fileName);
     }
 
+    template <typename Parser>
+    template <typename... Types>
+    void CommandLineInterpreterBase<Parser>::registerCommand(
+        const std::string& command,
+        const boost::function<typename cli::conversion::
+            CommandSignature<Types...>::Type>& callback)
+    {
+        typedef std::tuple<typename std::decay<Types>::type...> ValuesType;
+
+        onRunCommand(command, [this, callback](const std::string& command,
+            CommandArgumentsType const& arguments) -> bool
+        {
+            std::vector<std::string> words =
+                cli::traits::ParserTraits<Parser>::commandWords(arguments);
+
+            ValuesType values;
+            std::string error;
+            if (! cli::conversion::convertArguments(words, values, error)) {
+                onRunCommand.countError(command);
+                return parseError(ParseErrorType(command + ": " + error),
+                    currentLine_ ? *currentLine_ : std::string());
+            }
+            return cli::conversion::applyArguments(callback, values);
+        });
+    }
+
+    template <typename Parser>
+    void CommandLineInterpreterBase<Parser>::registerCacheableCommand(
+        const std::string& command,
+        const boost::function<typename cli::callback::
+            RunCommandCallback<Parser>::Signature>& callback,
+        const std::vector<std::string>& dependencies)
+    {
+        onRunCommand(command, [this, callback, dependencies](
+            const std::string& command,
+            CommandArgumentsType const& arguments) -> bool
+        {
+            // Sharing the output stream buffer between threads is not safe
+            if (isConcurrentMode_) {
+                return callback(command, arguments);
+            }
+
+            using cli::memoize::appendKey;
+
+            std::string key;
+            appendKey(key, command);
+            appendKey(key, arguments);
+            cli::memoize::appendDependenciesKey(key, dependencies);
+
+            cli::memoize::CachedResult result;
+            if (resultCache_.lookup(key, result)) {
+                out_ << result.output;
+                return result.isFinished;
+            }
+
+            // Restore the output stream buffer even if the callback throws
+            struct CaptureGuard
+            {
+                std::ostream& out;
+                cli::memoize::CaptureBuffer buffer;
+
+                CaptureGuard(std::ostream& out)
+                    : out(out), buffer(out.rdbuf())
+                    { out.rdbuf(&buffer); }
+                ~CaptureGuard()
+                    { out.rdbuf(buffer.target()); }
+            } captureGuard(out_);
+
+            result.isFinished = callback(command, arguments);
+            result.output = captureGuard.buffer.captured();
+            resultCache_.insert(key, result);
+            return result.isFinished;
+        });
+    }
+
     template <typename Parser>
     bool CommandLineInterpreterBase<Parser>::runCommand(
         const std::string& command, CommandArgumentsType const& arguments)
     {
-        return onRunCommand ? onRunCommand.call(command, arguments) : false;
+        typename cli::callback::RunCommandCallback<Parser>::CommandId id =
+            onRunCommand.commandId(command);
+        if (! onRunCommand.isCallable(id)) {
+            return command.empty() ? false : unknownCommand(command);
+        }
+        return onRunCommand.call(id, command, arguments);
+    }
+
+    template <typename Parser>
+    bool CommandLineInterpreterBase<Parser>::unknownCommand(
+        const std::string& command)
+    {
+        std::vector<std::string> suggestions =
+            onRunCommand.suggestions(command);
+        if (onUnknownCommand) {
+            return onUnknownCommand.call(command, suggestions);
+        }
+
+        err_ << cli::utility::programShortName()
+             << ": "
+             << command
+             << ": "
+             << translate("command not found");
+        if (! suggestions.empty()) {
+            err_ << ", " << translate("did you mean") << " "
+                 << boost::algorithm::join(suggestions, ", ") << "?";
+        }
+        err_ << std::endl;
+        return false;
     }
 
     template <typename Parser>
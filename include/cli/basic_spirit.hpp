@@ -54,6 +54,9 @@ namespace cli { namespace parser { namespace spiritparser
         const std::string& what() const
             { return what_; }
 
+        operator std::string() const
+            { return what_; }
+
         //
         // These attributes will only contains valid values if
         // hasExpectationFailure() returns true. For a description of it,
@@ -19,12 +19,20 @@
 #ifndef CALLBACKS_HPP_
 #define CALLBACKS_HPP_
 
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <new>
 #include <string>
-#include <map>
+#include <unordered_map>
 #include <vector>
 
 #include <boost/function.hpp>
 
+#include <cli/suggest.hpp>
 #include <cli/traits.hpp>
 
 namespace cli { namespace callback
@@ -53,6 +61,70 @@ namespace cli { namespace callback
     // Callback types for cli::CommandLineInterpreterBase class
     //
 
+    //
+    // Statistics collected by RunCommandCallback for every command
+    //
+
+    struct CommandStatistics
+    {
+        std::string command;
+        unsigned long long calls;
+        unsigned long long errors;
+        std::chrono::nanoseconds latency;
+    };
+
+namespace detail
+{
+    //
+    // Counters of a command. Every one is allocated alone in its own cache
+    // line, so updating the counters of one command does not invalidate
+    // the cache line of any other. std::allocator does not honour
+    // alignments over alignof(std::max_align_t) before C++17, so they are
+    // allocated by their own operator new. Atomics with relaxed ordering
+    // allow to read them from other threads without locking.
+    //
+
+    const std::size_t CACHE_LINE_SIZE = 64;
+
+    struct alignas(CACHE_LINE_SIZE) CommandCounters
+    {
+        std::atomic<unsigned long long> calls;
+        std::atomic<unsigned long long> errors;
+        std::atomic<unsigned long long> nanoseconds;
+
+        CommandCounters() : calls(0), errors(0), nanoseconds(0) {}
+
+        static void* operator new(std::size_t size)
+        {
+            void* memory;
+            if (::posix_memalign(&memory, CACHE_LINE_SIZE, size) != 0) {
+                throw std::bad_alloc();
+            }
+            return memory;
+        }
+
+        static void operator delete(void* memory)
+            { std::free(memory); }
+    };
+
+    static_assert(sizeof(CommandCounters) == CACHE_LINE_SIZE,
+        "CommandCounters must fill exactly one cache line");
+}
+
+    //
+    // Class RunCommandCallback
+    //
+    // Dispatch table of the command callbacks. Registrations are done on a
+    // private copy under the mutex, which is then published as an immutable
+    // snapshot with a new generation number. Every thread keeps in a small
+    // cache the snapshot it used last for every object. Dispatching only
+    // reads the atomic generation number to check that it is still
+    // current, so readers do not lock nor write any shared memory. The
+    // mutex is taken just once per thread after every registration, to
+    // refresh the cache. A replaced snapshot is released when no thread
+    // keeps it in its cache nor runs a command through it.
+    //
+
     template <typename Parser>
     class RunCommandCallback
         : public Callback<bool, const std::string&,
@@ -65,30 +137,319 @@ namespace cli { namespace callback
                 CommandArgumentsType const&> BaseType;
             typedef typename BaseType::Signature Signature;
 
+            //
+            // Every command name registered is interned and gets a small
+            // integer identifier, used as index of the dispatch table.
+            // DEFAULT_COMMAND_ID identifies every unregistered command.
+            //
+
+            typedef std::size_t CommandId;
+
+            static const CommandId DEFAULT_COMMAND_ID = 0;
+
+            RunCommandCallback()
+                : table_(new DispatchTable),
+                  instanceId_(nextInstanceId()),
+                  generation_(0)
+            {
+                counters_.emplace_back(new detail::CommandCounters);
+                table_->commandNames.push_back(std::string());
+                table_->callbacks.push_back(boost::function<Signature>());
+                table_->counters.push_back(counters_.back().get());
+                publish();
+            }
+
+            //
+            // Scripts and loops usually run the same command many times in
+            // a row, so every thread remembers the last registered command
+            // looked up and its identifier, that never changes once
+            // assigned. Then the command name is only compared, not hashed.
+            //
+
+            CommandId commandId(const std::string& command) const
+            {
+                LastCommand& last = lastCommand();
+                if (last.instanceId == instanceId_ &&
+                    last.command == command)
+                {
+                    return last.id;
+                }
+
+                const DispatchTable& table = *snapshot().table;
+                typename std::unordered_map<std::string,
+                    CommandId>::const_iterator i =
+                        table.commandIds.find(command);
+                if (i == table.commandIds.end()) {
+                    return DEFAULT_COMMAND_ID;
+                }
+
+                last.instanceId = instanceId_;
+                last.command = command;
+                last.id = i->second;
+                return i->second;
+            }
+
             bool call(const std::string& command,
                 CommandArgumentsType const& arguments) const
             {
-                typename std::map<std::string,
-                    boost::function<Signature> >::const_iterator i;
-                i = callbacks_.find(command);
-                if (i == callbacks_.end()) {
-                    return BaseType::call(command, arguments);
+                return call(commandId(command), command, arguments);
+            }
+
+            bool call(CommandId id, const std::string& command,
+                CommandArgumentsType const& arguments) const
+            {
+                // The snapshot must live until the callback returns, even
+                // if the callback refreshes the cache of this thread
+                CachedTable& cached = snapshot();
+                CachedTableUse use(cached);
+                const DispatchTable& table = *cached.table;
+                const boost::function<Signature>& callback =
+                    table.callbacks[id];
+                if (callback.empty()) {
+                    return false;
                 }
-                else {
-                    return i->second(command, arguments);
+
+                detail::CommandCounters& counters = *table.counters[id];
+                counters.calls.fetch_add(1, std::memory_order_relaxed);
+
+                std::chrono::steady_clock::time_point start =
+                    std::chrono::steady_clock::now();
+                try {
+                    bool isFinished = callback(command, arguments);
+                    addLatency(counters, start);
+                    return isFinished;
+                }
+                catch (...) {
+                    addLatency(counters, start);
+                    counters.errors.fetch_add(1, std::memory_order_relaxed);
+                    throw;
                 }
             }
 
-            using BaseType::operator();
+            bool isCallable(CommandId id) const
+                { return ! snapshot().table->callbacks[id].empty(); }
+
+            operator bool() const
+            {
+                const DispatchTable& table = *snapshot().table;
+                return ! (table.callbacks[DEFAULT_COMMAND_ID].empty() &&
+                    table.commandIds.empty());
+            }
 
-            void operator()(const std::string& command,
+            //
+            // Members to register callback functions. They can be invoked
+            // while other threads dispatch commands.
+            //
+
+            void operator()(boost::function<Signature> const& callback)
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                table_->callbacks[DEFAULT_COMMAND_ID] = callback;
+                publish();
+            }
+
+            CommandId operator()(const std::string& command,
                 boost::function<Signature> const& callback)
             {
-                callbacks_[command] = callback;
+                std::lock_guard<std::mutex> lock(mutex_);
+
+                CommandId id;
+                typename std::unordered_map<std::string,
+                    CommandId>::const_iterator i =
+                        table_->commandIds.find(command);
+                if (i == table_->commandIds.end()) {
+                    id = table_->callbacks.size();
+                    counters_.emplace_back(new detail::CommandCounters);
+                    table_->commandIds[command] = id;
+                    table_->commandNames.push_back(command);
+                    table_->callbacks.push_back(callback);
+                    table_->counters.push_back(counters_.back().get());
+                    similarNames_.insert(command);
+                }
+                else {
+                    id = i->second;
+                    table_->callbacks[id] = callback;
+                }
+
+                publish();
+                return id;
+            }
+
+            //
+            // Members to suggest registered commands, or any other name
+            // added with addSuggestions(), similar to a mistyped one
+            //
+
+            void addSuggestions(const std::vector<std::string>& names)
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                for (std::vector<std::string>::const_iterator i =
+                    names.begin(); i < names.end(); ++i)
+                {
+                    similarNames_.insert(*i);
+                }
+            }
+
+            std::vector<std::string> suggestions(
+                const std::string& command) const
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                return similarNames_.search(command);
+            }
+
+            //
+            // Members to access the statistics of the commands. The entry
+            // of DEFAULT_COMMAND_ID has an empty command name.
+            //
+
+            void countError(const std::string& command) const
+            {
+                CommandId id = commandId(command);
+                snapshot().table->counters[id]->errors.fetch_add(1,
+                    std::memory_order_relaxed);
+            }
+
+            std::vector<CommandStatistics> statistics() const
+            {
+                const DispatchTable& table = *snapshot().table;
+
+                std::vector<CommandStatistics> statistics;
+                for (CommandId id = 0; id < table.commandNames.size(); ++id) {
+                    const detail::CommandCounters& counters =
+                        *table.counters[id];
+                    CommandStatistics entry;
+                    entry.command = table.commandNames[id];
+                    entry.calls = counters.calls.load(
+                        std::memory_order_relaxed);
+                    entry.errors = counters.errors.load(
+                        std::memory_order_relaxed);
+                    entry.latency = std::chrono::nanoseconds(
+                        counters.nanoseconds.load(std::memory_order_relaxed));
+                    statistics.push_back(entry);
+                }
+                return statistics;
             }
 
         private:
-            std::map<std::string, boost::function<Signature> > callbacks_;
+            struct DispatchTable
+            {
+                std::unordered_map<std::string, CommandId> commandIds;
+                std::vector<std::string> commandNames;
+                std::vector<boost::function<Signature> > callbacks;
+                std::vector<detail::CommandCounters*> counters;
+            };
+
+            // Members protected by mutex_
+            mutable std::mutex mutex_;
+            std::unique_ptr<DispatchTable> table_;
+            cli::suggest::BKTree similarNames_;
+
+            // The counters do not move when the vector grows
+            std::vector<std::unique_ptr<detail::CommandCounters> > counters_;
+
+            // Identifies this object in the lookup cache of every thread,
+            // even if another one is created later at the same address
+            std::size_t instanceId_;
+
+            // Last snapshot published, protected by mutex_, and its
+            // generation, which can be read without locking
+            std::shared_ptr<const DispatchTable> publishedTable_;
+            std::atomic<unsigned long> generation_;
+
+            //
+            // Snapshot cached by a thread. The snapshots replaced while
+            // some command runs through the entry are kept in 'retired'
+            // until it finishes.
+            //
+
+            struct CachedTable
+            {
+                std::size_t instanceId;
+                unsigned long generation;
+                std::shared_ptr<const DispatchTable> table;
+                unsigned uses;
+                std::vector<std::shared_ptr<const DispatchTable> > retired;
+
+                CachedTable() : instanceId(0), generation(0), uses(0) {}
+            };
+
+            struct CachedTableUse
+            {
+                CachedTable& cached;
+
+                CachedTableUse(CachedTable& cached)
+                    : cached(cached)
+                    { ++cached.uses; }
+                ~CachedTableUse()
+                {
+                    if (--cached.uses == 0) {
+                        cached.retired.clear();
+                    }
+                }
+            };
+
+            // Objects share the entries with the same identifier modulo
+            // the size of the cache
+            static const std::size_t CACHED_TABLES = 8;
+
+            CachedTable& snapshot() const
+            {
+                static thread_local CachedTable cache[CACHED_TABLES];
+
+                CachedTable& cached = cache[instanceId_ % CACHED_TABLES];
+                if (cached.instanceId != instanceId_ ||
+                    cached.generation !=
+                        generation_.load(std::memory_order_acquire))
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    if (cached.uses > 0) {
+                        cached.retired.push_back(cached.table);
+                    }
+                    cached.instanceId = instanceId_;
+                    cached.generation = generation_.load(
+                        std::memory_order_relaxed);
+                    cached.table = publishedTable_;
+                }
+                return cached;
+            }
+
+            // Must be invoked with mutex_ locked
+            void publish()
+            {
+                publishedTable_.reset(new DispatchTable(*table_));
+                generation_.fetch_add(1, std::memory_order_release);
+            }
+
+            struct LastCommand
+            {
+                std::size_t instanceId;
+                std::string command;
+                CommandId id;
+
+                LastCommand() : instanceId(0), id(DEFAULT_COMMAND_ID) {}
+            };
+
+            static LastCommand& lastCommand()
+            {
+                static thread_local LastCommand last;
+                return last;
+            }
+
+            static std::size_t nextInstanceId()
+            {
+                static std::atomic<std::size_t> instances(0);
+                return instances.fetch_add(1) + 1;
+            }
+
+            static void addLatency(detail::CommandCounters& counters,
+                std::chrono::steady_clock::time_point start)
+            {
+                std::chrono::nanoseconds elapsed =
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - start);
+                counters.nanoseconds.fetch_add(elapsed.count(),
+                    std::memory_order_relaxed);
+            }
     };
 
     template <typename Parser>
@@ -98,6 +459,8 @@ namespace cli { namespace callback
               const std::string&>
     {};
 
+    typedef Callback<bool, const std::string&,
+        const std::vector<std::string>&> UnknownCommandCallback;
     typedef Callback<bool> EmptyLineCallback;
     typedef Callback<void, std::string&> PreRunCommandCallback;
     typedef Callback<bool, bool, const std::string&> PostRunCommandCallback;
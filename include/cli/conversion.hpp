@@ -0,0 +1,346 @@
+/*
+ * conversion.hpp - Conversion of command arguments to typed values
+ *
+ *   Copyright 2010-2016 Jesús Torres <jmtorres@ull.es>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CONVERSION_HPP_
+#define CONVERSION_HPP_
+
+#include <cctype>
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+#include <boost/filesystem/path.hpp>
+
+#define translate(str) str  // TODO: Use Boost.Locale when available
+
+namespace cli { namespace conversion
+{
+    //
+    // Class EnumNames
+    //
+    // Specialize it to allow commands to take arguments of an enum type.
+    // names() must return an array of name-value pairs ended by an element
+    // whose name is NULL. E.g.:
+    //
+    //  template <>
+    //  struct EnumNames<Mode>
+    //  {
+    //      static const EnumName<Mode>* names()
+    //      {
+    //          static const EnumName<Mode> names[] = {
+    //              {"fast", Mode::FAST},
+    //              {"safe", Mode::SAFE},
+    //              {NULL, Mode()}
+    //          };
+    //          return names;
+    //      }
+    //  };
+    //
+
+    template <typename Enum>
+    struct EnumName
+    {
+        const char* name;
+        Enum value;
+    };
+
+    template <typename Enum>
+    struct EnumNames;
+
+    //
+    // Numbers are converted with the strto*() functions, which skip
+    // leading white space. Quoted words could have it, but then they are
+    // not numbers.
+    //
+
+    inline bool isSpace(char c)
+    {
+        return std::isspace(static_cast<unsigned char>(c)) != 0;
+    }
+
+    //
+    // Class ArgumentConverter
+    //
+    // Converts one command argument to a value of type T. convert() returns
+    // false and sets 'expected' to a description of the valid values when
+    // the word can not be converted.
+    //
+
+    template <typename T, typename Enable = void>
+    struct ArgumentConverter;
+
+    template <>
+    struct ArgumentConverter<std::string>
+    {
+        static bool convert(const std::string& word, std::string& value,
+            std::string& expected)
+        {
+            value = word;
+            return true;
+        }
+    };
+
+    template <>
+    struct ArgumentConverter<boost::filesystem::path>
+    {
+        static bool convert(const std::string& word,
+            boost::filesystem::path& value, std::string& expected)
+        {
+            if (word.empty()) {
+                expected = translate("a path name");
+                return false;
+            }
+            value = word;
+            return true;
+        }
+    };
+
+    template <>
+    struct ArgumentConverter<bool>
+    {
+        static bool convert(const std::string& word, bool& value,
+            std::string& expected)
+        {
+            static const char* const TRUE_WORDS[] = {
+                "1", "true", "yes", "on", NULL
+            };
+            static const char* const FALSE_WORDS[] = {
+                "0", "false", "no", "off", NULL
+            };
+
+            for (const char* const* i = TRUE_WORDS; *i != NULL; ++i) {
+                if (word == *i) {
+                    value = true;
+                    return true;
+                }
+            }
+            for (const char* const* i = FALSE_WORDS; *i != NULL; ++i) {
+                if (word == *i) {
+                    value = false;
+                    return true;
+                }
+            }
+            expected = translate("a boolean value");
+            return false;
+        }
+    };
+
+    template <typename T>
+    struct ArgumentConverter<T, typename std::enable_if<
+        std::is_integral<T>::value && std::is_signed<T>::value>::type>
+    {
+        static bool convert(const std::string& word, T& value,
+            std::string& expected)
+        {
+            const char* begin = word.c_str();
+            char* end;
+            errno = 0;
+            long long number = std::strtoll(begin, &end, 10);
+            if (word.empty() || isSpace(word[0]) || *end != '\0' ||
+                errno == ERANGE ||
+                number < std::numeric_limits<T>::min() ||
+                number > std::numeric_limits<T>::max())
+            {
+                expected = translate("an integer number");
+                return false;
+            }
+            value = static_cast<T>(number);
+            return true;
+        }
+    };
+
+    template <typename T>
+    struct ArgumentConverter<T, typename std::enable_if<
+        std::is_integral<T>::value && std::is_unsigned<T>::value &&
+        ! std::is_same<T, bool>::value>::type>
+    {
+        static bool convert(const std::string& word, T& value,
+            std::string& expected)
+        {
+            const char* begin = word.c_str();
+            char* end;
+            errno = 0;
+            unsigned long long number = std::strtoull(begin, &end, 10);
+            if (word.empty() || isSpace(word[0]) || word[0] == '-' ||
+                *end != '\0' || errno == ERANGE ||
+                number > std::numeric_limits<T>::max())
+            {
+                expected = translate("a non-negative integer number");
+                return false;
+            }
+            value = static_cast<T>(number);
+            return true;
+        }
+    };
+
+    template <typename T>
+    struct ArgumentConverter<T, typename std::enable_if<
+        std::is_floating_point<T>::value>::type>
+    {
+        static bool convert(const std::string& word, T& value,
+            std::string& expected)
+        {
+            const char* begin = word.c_str();
+            char* end;
+            errno = 0;
+            long double number = std::strtold(begin, &end);
+            if (word.empty() || isSpace(word[0]) || *end != '\0' ||
+                errno == ERANGE)
+            {
+                expected = translate("a real number");
+                return false;
+            }
+            value = static_cast<T>(number);
+            return true;
+        }
+    };
+
+    template <typename T>
+    struct ArgumentConverter<T, typename std::enable_if<
+        std::is_enum<T>::value>::type>
+    {
+        static bool convert(const std::string& word, T& value,
+            std::string& expected)
+        {
+            const EnumName<T>* names = EnumNames<T>::names();
+            for (const EnumName<T>* i = names; i->name != NULL; ++i) {
+                if (word == i->name) {
+                    value = i->value;
+                    return true;
+                }
+            }
+
+            expected = translate("one of");
+            for (const EnumName<T>* i = names; i->name != NULL; ++i) {
+                expected += (i == names) ? " " : ", ";
+                expected += i->name;
+            }
+            return false;
+        }
+    };
+
+namespace detail
+{
+    //
+    // Compile-time sequence of indexes used to unpack std::tuple objects
+    //
+
+    template <std::size_t... Indexes>
+    struct IndexSequence
+    {};
+
+    template <std::size_t N, std::size_t... Indexes>
+    struct MakeIndexSequence
+        : MakeIndexSequence<N - 1, N - 1, Indexes...>
+    {};
+
+    template <std::size_t... Indexes>
+    struct MakeIndexSequence<0, Indexes...>
+    {
+        typedef IndexSequence<Indexes...> Type;
+    };
+
+    template <std::size_t I, typename Tuple>
+    typename std::enable_if<(I == std::tuple_size<Tuple>::value), bool>::type
+    convertArguments(const std::vector<std::string>& words, Tuple& values,
+        std::string& error)
+    {
+        return true;
+    }
+
+    template <std::size_t I, typename Tuple>
+    typename std::enable_if<(I < std::tuple_size<Tuple>::value), bool>::type
+    convertArguments(const std::vector<std::string>& words, Tuple& values,
+        std::string& error)
+    {
+        typedef typename std::tuple_element<I, Tuple>::type ValueType;
+
+        std::string expected;
+        bool success = ArgumentConverter<ValueType>::convert(words[I],
+            std::get<I>(values), expected);
+        if (! success) {
+            std::ostringstream message;
+            message << translate("invalid argument") << " '" << words[I]
+                    << "' " << translate("at position") << " " << (I + 1)
+                    << ", " << translate("expecting") << " " << expected;
+            error = message.str();
+            return false;
+        }
+        return convertArguments<I + 1>(words, values, error);
+    }
+
+    template <typename Function, typename Tuple, std::size_t... Indexes>
+    bool applyArguments(const Function& function, Tuple& values,
+        IndexSequence<Indexes...>)
+    {
+        return function(std::get<Indexes>(values)...);
+    }
+}
+
+    //
+    // Signature of the callback functions which receive the converted
+    // values. It is used as a non-deduced context, so the argument types
+    // must be explicitly specified.
+    //
+
+    template <typename... Types>
+    struct CommandSignature
+    {
+        typedef bool (Type)(Types...);
+    };
+
+    //
+    // Convert every command argument to the type in the same position of
+    // the tuple 'values'. On failure a description of the problem is
+    // returned in 'error'.
+    //
+
+    template <typename... Types>
+    bool convertArguments(const std::vector<std::string>& words,
+        std::tuple<Types...>& values, std::string& error)
+    {
+        if (words.size() != sizeof...(Types)) {
+            std::ostringstream message;
+            message << translate("wrong number of arguments") << ", "
+                    << translate("expecting") << " " << sizeof...(Types);
+            error = message.str();
+            return false;
+        }
+        return detail::convertArguments<0>(words, values, error);
+    }
+
+    //
+    // Invoke function passing the values in the tuple as arguments
+    //
+
+    template <typename Function, typename... Types>
+    bool applyArguments(const Function& function,
+        std::tuple<Types...>& values)
+    {
+        return detail::applyArguments(function, values,
+            typename detail::MakeIndexSequence<sizeof...(Types)>::Type());
+    }
+}}
+
+#endif /* CONVERSION_HPP_ */
@@ -19,17 +19,79 @@
 #ifndef PRETTYPRINT_DETAIL_HPP_
 #define PRETTYPRINT_DETAIL_HPP_
 
+#include <algorithm>
+#include <iterator>
+#include <ostream>
+
+#include <cli/chart_literal.hpp>
+
 namespace cli { namespace prettyprint { namespace detail
 {
     extern const int INDENT_DEFAULT_WIDTH;
 
     //
-    // Indexes in stream internal extensible array
+    // Index in stream internal extensible array
+    //
+    // The whole state is packed in one element, so every manipulator needs
+    // only one iword() lookup. It fits in 32 bits:
+    //
+    //  bits 0-1    flags
+    //  bits 8-15   indentation width
+    //  bits 16-30  indentation space
+    //
+
+    extern const int STATE_INDEX;
+
+    const long PRETTYPRINT_ENABLED_FLAG = 1L << 0;
+    const long BUFFERED_FLAG = 1L << 1;
+
+    const int INDENT_WIDTH_SHIFT = 8;
+    const long INDENT_WIDTH_MASK = 0xffL << INDENT_WIDTH_SHIFT;
+    const int INDENT_SPACE_SHIFT = 16;
+    const long INDENT_SPACE_MASK = 0x7fffL << INDENT_SPACE_SHIFT;
+
+    inline int indentWidth(long state)
+    {
+        return (state & INDENT_WIDTH_MASK) >> INDENT_WIDTH_SHIFT;
+    }
+
+    inline int indentSpace(long state)
+    {
+        return (state & INDENT_SPACE_MASK) >> INDENT_SPACE_SHIFT;
+    }
+
+    inline long setIndentWidth(long state, int width)
+    {
+        width = std::min(std::max(width, 0), 0xff);
+        return (state & ~INDENT_WIDTH_MASK) |
+            (static_cast<long>(width) << INDENT_WIDTH_SHIFT);
+    }
+
+    inline long setIndentSpace(long state, int space)
+    {
+        space = std::min(std::max(space, 0), 0x7fff);
+        return (state & ~INDENT_SPACE_MASK) |
+            (static_cast<long>(space) << INDENT_SPACE_SHIFT);
+    }
+
+    //
+    // Insert an end-of-line, flushing the stream unless buffered mode is
+    // enabled, and the indentation of the next line. The spaces are put
+    // straight into the stream buffer instead of building a string.
     //
 
-    extern const int PRETTYPRINT_ENABLED_FLAG_INDEX;
-    extern const int INDENT_SPACE_INDEX;
-    extern const int INDENT_WIDTH_INDEX;
+    template <typename CharT, typename Traits>
+    void newLine(std::basic_ostream<CharT, Traits>& os, long state)
+    {
+        os.put(CHART_LITERAL(CharT, '\n'));
+        if ((state & PRETTYPRINT_ENABLED_FLAG) && os.rdbuf() != NULL) {
+            std::fill_n(std::ostreambuf_iterator<CharT, Traits>(os),
+                indentSpace(state), CHART_LITERAL(CharT, ' '));
+        }
+        if (! (state & BUFFERED_FLAG)) {
+            os.flush();
+        }
+    }
 }}}
 
 #endif /* PRETTYPRINT_DETAIL_HPP_ */
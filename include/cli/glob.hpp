@@ -19,11 +19,23 @@
 #ifndef GLOB_HPP_
 #define GLOB_HPP_
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <ctime>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <system_error>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
+#include <sys/types.h>
+
 #include <boost/filesystem.hpp>
 
 namespace glob
@@ -54,11 +66,397 @@ namespace glob
         EXPAND_TILDE                        = GLOB_TILDE,
         EXPAND_TILDE_WITH_CHECK             = GLOB_TILDE_CHECK,
 #endif /* _GNU_SOURCE */
+        // Not a flag of glob(). A component '**' matches any number of
+        // directories, if it is followed by a slash, or any path name
+        // inside them, if it is the last one.
+        EXPAND_RECURSIVE_WILDCARD           = 1 << 24,
+    };
+
+    //
+    // Errors of the expansion, besides those of the system, reported
+    // through the error handling of Glob and GlobStream
+    //
+
+    enum class GlobError
+    {
+        LIMIT_EXCEEDED = 1,     // A limit of GlobOptions was exceeded
+        CANCELLED               // By the cancellation token
+    };
+
+    const std::error_category& globCategory();
+
+    inline std::error_code make_error_code(GlobError error)
+    {
+        return std::error_code(static_cast<int>(error), globCategory());
+    }
+
+    class GlobProducer;
+    class GlobWalker;
+
+    //
+    // Class DirectoryCache
+    //
+    // Entries of the directories read by Glob, so the same directories
+    // are not read again by the following Glob objects while they do not
+    // change. Every directory is watched with inotify and its entries are
+    // discarded as soon as an entry is created, removed or renamed. If
+    // inotify is not available, the modification time of the directory is
+    // checked instead. The inotify instance, limited per user, is only
+    // created when the first directory is read.
+    //
+    // The size of the directory entries stored is kept below the budget
+    // by discarding the least recently used directories.
+    //
+
+    class DirectoryCache
+    {
+        public:
+            static const std::size_t DEFAULT_BUDGET = 4 * 1024 * 1024;
+
+            DirectoryCache(std::size_t budget = DEFAULT_BUDGET);
+            ~DirectoryCache();
+
+            DirectoryCache(const DirectoryCache&) = delete;
+            DirectoryCache& operator=(const DirectoryCache&) = delete;
+
+            void clear();
+
+            void budget(std::size_t budget);
+            std::size_t budget() const;
+
+            //
+            // Statistics
+            //
+
+            std::size_t size() const;
+            unsigned long long hits() const;
+            unsigned long long misses() const;
+
+        private:
+            friend class GlobWalker;
+
+            typedef std::vector<std::pair<std::string, unsigned char> >
+                EntriesType;
+
+            struct Directory
+            {
+                std::string path;
+                std::shared_ptr<const EntriesType> entries;
+                std::size_t size;
+                int watch;
+                dev_t device;
+                ino_t inode;
+                struct timespec modificationTime;
+            };
+
+            typedef std::list<Directory> DirectoriesType;
+
+            mutable std::mutex mutex_;
+            DirectoriesType directories_;   // Most recently used first
+            std::unordered_map<std::string, DirectoriesType::iterator> index_;
+            std::unordered_multimap<int, std::string> watches_;
+            int inotifyFd_;
+            bool isInotifyStarted_;
+            std::size_t budget_;
+            std::size_t size_;
+            unsigned long long hits_;
+            unsigned long long misses_;
+
+            //
+            // Members used by GlobWalker. Paths must be absolute.
+            //
+
+            void update();
+            std::shared_ptr<const EntriesType> lookup(const std::string& path);
+            std::shared_ptr<const EntriesType> read(const std::string& path,
+                std::vector<char>& buffer, int& errorNumber);
+
+            int startInotify();
+            void erase(DirectoriesType::iterator directory);
+            void shrink(std::size_t budget);
+    };
+
+    //
+    // Class StringPool
+    //
+    // Strings stored one after another, ended by NUL, in a single buffer,
+    // with an array with the offset of every one of them. They are added
+    // with two amortized allocations at most, and argv() points to them
+    // without copying them, so they can be passed to exec().
+    //
+
+    class StringPool
+    {
+        public:
+            class iterator
+            {
+                public:
+                    typedef std::random_access_iterator_tag
+                        iterator_category;
+                    typedef const char* value_type;
+                    typedef std::ptrdiff_t difference_type;
+                    typedef const char* const* pointer;
+                    typedef const char* reference;
+
+                    iterator()
+                        : pool_(NULL), index_(0)
+                    {}
+
+                    reference operator*() const
+                        { return (*pool_)[index_]; }
+                    reference operator[](difference_type n) const
+                        { return (*pool_)[index_ + n]; }
+
+                    iterator& operator++()
+                        { ++index_; return *this; }
+                    iterator operator++(int)
+                        { iterator previous(*this); ++index_; return previous; }
+                    iterator& operator--()
+                        { --index_; return *this; }
+                    iterator operator--(int)
+                        { iterator previous(*this); --index_; return previous; }
+                    iterator& operator+=(difference_type n)
+                        { index_ += n; return *this; }
+                    iterator& operator-=(difference_type n)
+                        { index_ -= n; return *this; }
+                    iterator operator+(difference_type n) const
+                        { return iterator(pool_, index_ + n); }
+                    iterator operator-(difference_type n) const
+                        { return iterator(pool_, index_ - n); }
+                    difference_type operator-(const iterator& other) const
+                        { return static_cast<difference_type>(index_) -
+                            static_cast<difference_type>(other.index_); }
+
+                    bool operator==(const iterator& other) const
+                        { return index_ == other.index_; }
+                    bool operator!=(const iterator& other) const
+                        { return index_ != other.index_; }
+                    bool operator<(const iterator& other) const
+                        { return index_ < other.index_; }
+                    bool operator>(const iterator& other) const
+                        { return index_ > other.index_; }
+                    bool operator<=(const iterator& other) const
+                        { return index_ <= other.index_; }
+                    bool operator>=(const iterator& other) const
+                        { return index_ >= other.index_; }
+
+                private:
+                    friend class StringPool;
+
+                    const StringPool* pool_;
+                    std::size_t index_;
+
+                    iterator(const StringPool* pool, std::size_t index)
+                        : pool_(pool), index_(index)
+                    {}
+            };
+
+            void push_back(const char* value, std::size_t size)
+            {
+                offsets_.push_back(buffer_.size());
+                buffer_.insert(buffer_.end(), value, value + size);
+                buffer_.push_back('\0');
+            }
+
+            void push_back(const std::string& value)
+                { push_back(value.data(), value.size()); }
+
+            void append(const StringPool& other)
+            {
+                std::size_t shift = buffer_.size();
+                buffer_.insert(buffer_.end(), other.buffer_.begin(),
+                    other.buffer_.end());
+                for (std::vector<std::size_t>::const_iterator i =
+                    other.offsets_.begin(); i < other.offsets_.end(); ++i)
+                {
+                    offsets_.push_back(*i + shift);
+                }
+            }
+
+            void clear()
+            {
+                buffer_.clear();
+                offsets_.clear();
+            }
+
+            void reserve(std::size_t strings, std::size_t characters)
+            {
+                offsets_.reserve(strings);
+                buffer_.reserve(characters);
+            }
+
+            //
+            // Sort the strings from 'first' on. Only the offsets are moved.
+            //
+
+            template <typename Compare>
+            void sort(std::size_t first, Compare compare)
+            {
+                const char* buffer = buffer_.data();
+                std::sort(offsets_.begin() + first, offsets_.end(),
+                    [buffer, &compare](std::size_t a, std::size_t b)
+                    {
+                        return compare(buffer + a, buffer + b);
+                    });
+            }
+
+            //
+            // Pointers to every string, followed by NULL
+            //
+
+            std::vector<char*> argv() const
+            {
+                std::vector<char*> pointers;
+                pointers.reserve(offsets_.size() + 1);
+                for (std::vector<std::size_t>::const_iterator i =
+                    offsets_.begin(); i < offsets_.end(); ++i)
+                {
+                    pointers.push_back(const_cast<char*>(buffer_.data() + *i));
+                }
+                pointers.push_back(NULL);
+                return pointers;
+            }
+
+            const char* operator[](std::size_t index) const
+                { return buffer_.data() + offsets_[index]; }
+
+            iterator begin() const
+                { return iterator(this, 0); }
+            iterator end() const
+                { return iterator(this, offsets_.size()); }
+
+            std::size_t size() const
+                { return offsets_.size(); }
+            bool empty() const
+                { return offsets_.empty(); }
+
+        private:
+            std::vector<char> buffer_;
+            std::vector<std::size_t> offsets_;
+    };
+
+    //
+    // Ranges [begin, end) of the characters of a pattern which were quoted,
+    // so they must be matched literally, as if they were escaped
+    //
+
+    typedef std::vector<std::pair<std::size_t, std::size_t> > QuotedRanges;
+
+    //
+    // Class CancellationToken
+    //
+    // Flag to cancel the expansions given it through their options.
+    // cancel() is async-signal-safe, so it can be invoked from the handler
+    // of a signal like SIGINT.
+    //
+
+    class CancellationToken
+    {
+        public:
+            CancellationToken()
+                : isCancelled_(false)
+            {}
+
+            void cancel()
+                { isCancelled_.store(true, std::memory_order_relaxed); }
+            void reset()
+                { isCancelled_.store(false, std::memory_order_relaxed); }
+            bool isCancelled() const
+                { return isCancelled_.load(std::memory_order_relaxed); }
+
+        private:
+            std::atomic<bool> isCancelled_;
+    };
+
+    //
+    // Class GlobOptions
+    //
+    // Class GlobBudget
+    //
+    // Directory entries read and path names found by the expansions, and
+    // the time since it was created or reset, which are charged against
+    // the limits of their options. The expansions given the same budget
+    // share those limits, as if they were a single one.
+    //
+
+    class GlobBudget
+    {
+        public:
+            GlobBudget()
+                { reset(); }
+
+            void reset()
+            {
+                entriesVisited_ = 0;
+                pathNames_ = 0;
+                startTime_ = std::chrono::steady_clock::now();
+                isExceeded_ = false;
+            }
+
+            bool isExceeded() const
+                { return isExceeded_; }
+
+        private:
+            friend class GlobWalker;
+
+            std::atomic<std::size_t> entriesVisited_;
+            std::atomic<std::size_t> pathNames_;
+            std::chrono::steady_clock::time_point startTime_;
+            std::atomic<bool> isExceeded_;
+    };
+
+    //
+    // Options of Glob besides the flags of glob(). Several Glob objects
+    // can share the same 'directoryCache'.
+    //
+    // The directories matched by '**' are walked by 'recursionThreads'
+    // threads, one per processor if it is 0. The walk does not go deeper
+    // than 'maxRecursionDepth' levels nor, if 'isMountPointCrossed' is
+    // false, into directories of other file systems. Symbolic links are
+    // never followed.
+    //
+    // The expansion stops, reporting GlobError::LIMIT_EXCEEDED, if it reads
+    // more than 'maxEntriesVisited' directory entries, finds more than
+    // 'maxPathNames' path names or runs longer than 'maxTime', if it is not
+    // zero. It stops too, reporting GlobError::CANCELLED, when the
+    // 'cancellationToken' is cancelled. The path names found until then
+    // are kept. Every expansion has its own budget for these limits unless
+    // one is given in 'budget'.
+    //
+
+    struct GlobOptions
+    {
+        DirectoryCache* directoryCache;
+        std::size_t maxRecursionDepth;
+        bool isMountPointCrossed;
+        unsigned recursionThreads;
+
+        std::size_t maxEntriesVisited;
+        std::size_t maxPathNames;
+        std::chrono::milliseconds maxTime;
+        const CancellationToken* cancellationToken;
+        GlobBudget* budget;
+
+        GlobOptions()
+            : directoryCache(NULL),
+              maxRecursionDepth(static_cast<std::size_t>(-1)),
+              isMountPointCrossed(true),
+              recursionThreads(0),
+              maxEntriesVisited(static_cast<std::size_t>(-1)),
+              maxPathNames(static_cast<std::size_t>(-1)),
+              maxTime(0),
+              cancellationToken(NULL),
+              budget(NULL)
+        {}
     };
 
     //
     // Class Glob
     //
+    // Path names matching a pattern, with the semantics of the POSIX glob()
+    // function and its GNU extensions. The directories are walked by a
+    // native implementation instead of calling glob().
+    //
 
     class Glob
     {
@@ -67,14 +465,22 @@ namespace glob
             typedef std::vector<std::pair<
                 std::string, std::error_code> > ErrorsType;
 
-            Glob(const std::string& pattern, GlobFlags flags = GlobFlags::NONE);
+            Glob(const std::string& pattern, GlobFlags flags = GlobFlags::NONE,
+                const GlobOptions& options = GlobOptions());
+            Glob(const std::string& pattern, const QuotedRanges& quoted,
+                GlobFlags flags = GlobFlags::NONE,
+                const GlobOptions& options = GlobOptions());
             virtual ~Glob() {}
 
             //
-            // Overloaded cast operators to get the list of path names found
+            // Path names found, and overloaded cast operators to get a
+            // copy of them
             //
 
-            operator const std::vector<std::string>&() const;
+            const StringPool& pathNames() const
+                { return pathNames_; }
+
+            operator std::vector<std::string>() const;
             operator std::vector<filesystem::path>() const;
 
             //
@@ -89,6 +495,7 @@ namespace glob
             //
 
             static std::string escape(const std::string& pattern);
+            static std::string unescape(const std::string& pattern);
 
         private:
              ErrorsType errors_;
@@ -97,25 +504,266 @@ namespace glob
                  std::error_code errorCode);
 
 
-             std::vector<std::string> pathNames_;
+             StringPool pathNames_;
 
-             friend int onGlobError(const char* epath, int eerrno);
+             friend class GlobWalker;
     };
 
-    inline Glob::operator const std::vector<std::string>&() const
+    inline Glob::operator std::vector<std::string>() const
     {
-        return pathNames_;
+        return std::vector<std::string>(pathNames_.begin(),
+            pathNames_.end());
     }
 
     inline Glob::operator std::vector<filesystem::path>() const
     {
-        std::vector<filesystem::path> pathNames;
-        for (std::vector<std::string>::const_iterator i =
-            pathNames_.begin(); i < pathNames_.end(); ++i)
-        {
-            pathNames.push_back(filesystem::path(*i));
+        return std::vector<filesystem::path>(pathNames_.begin(),
+            pathNames_.end());
+    }
+
+    //
+    // Class GlobStream
+    //
+    // Path names matching a pattern, as Glob does, but they are found by
+    // another thread while they are read through a single-pass input
+    // iterator, so only a few of them are kept in memory at once. They are
+    // not sorted, as if GLOB_NOSORT were set. The errors are reported when
+    // the iterator reaches them, and the walk stops if onError() returns
+    // true. Destroying the stream stops the walk too. An exception thrown
+    // while walking is rethrown when the iterator reaches the end.
+    //
+    // The directory cache and the budget of the options, if any, must
+    // outlive the stream.
+    //
+
+    class GlobStream
+    {
+        public:
+            typedef Glob::ErrorsType ErrorsType;
+
+            class iterator
+            {
+                public:
+                    typedef std::input_iterator_tag iterator_category;
+                    typedef std::string value_type;
+                    typedef std::ptrdiff_t difference_type;
+                    typedef const std::string* pointer;
+                    typedef const std::string& reference;
+
+                    iterator()
+                        : stream_(NULL)
+                    {}
+
+                    reference operator*() const
+                        { return pathName_; }
+                    pointer operator->() const
+                        { return &pathName_; }
+
+                    iterator& operator++()
+                    {
+                        if (! stream_->next(pathName_)) {
+                            stream_ = NULL;
+                        }
+                        return *this;
+                    }
+
+                    iterator operator++(int)
+                    {
+                        iterator previous(*this);
+                        ++*this;
+                        return previous;
+                    }
+
+                    bool operator==(const iterator& other) const
+                        { return stream_ == other.stream_; }
+                    bool operator!=(const iterator& other) const
+                        { return stream_ != other.stream_; }
+
+                private:
+                    friend class GlobStream;
+
+                    GlobStream* stream_;
+                    std::string pathName_;
+
+                    explicit iterator(GlobStream* stream)
+                        : stream_(stream)
+                    { ++*this; }
+            };
+
+            GlobStream(const std::string& pattern,
+                GlobFlags flags = GlobFlags::NONE,
+                const GlobOptions& options = GlobOptions());
+            GlobStream(const std::string& pattern, const QuotedRanges& quoted,
+                GlobFlags flags = GlobFlags::NONE,
+                const GlobOptions& options = GlobOptions());
+            virtual ~GlobStream();
+
+            GlobStream(const GlobStream&) = delete;
+            GlobStream& operator=(const GlobStream&) = delete;
+
+            iterator begin()
+                { return iterator(this); }
+            iterator end()
+                { return iterator(); }
+
+            //
+            // Error handling
+            //
+
+            const ErrorsType& errors() const
+                { return errors_; }
+
+        private:
+            ErrorsType errors_;
+            std::unique_ptr<GlobProducer> producer_;
+            bool isFinished_;
+
+            virtual bool onError(const std::string& pathName,
+                std::error_code errorCode);
+
+            bool next(std::string& pathName);
+            void finish();
+    };
+
+    //
+    // Class BraceExpansion
+    //
+    // Words generated from a pattern with brace expressions, which can be
+    // lists, like '{a,b,c}', or numeric or alphabetic ranges, like
+    // '{1..10}', '{01..10..2}' or '{a..z}'. The expressions can be nested.
+    // The quoted or escaped characters are taken literally, and the
+    // brace expressions which are neither a list nor a range are left as
+    // they are, as bash does.
+    //
+    // The number of words is counted without generating them, and every
+    // word is built by the iterator when it is reached, so no more than
+    // one word is kept in memory. The constructor throws std::system_error
+    // with E2BIG if there would be more words than 'limit'.
+    //
+
+    class BraceExpansion
+    {
+        public:
+            static const std::size_t DEFAULT_LIMIT = 100000;
+
+            struct Word
+            {
+                std::string text;
+                QuotedRanges quoted;
+            };
+
+            class iterator
+            {
+                public:
+                    typedef std::input_iterator_tag iterator_category;
+                    typedef Word value_type;
+                    typedef std::ptrdiff_t difference_type;
+                    typedef const Word* pointer;
+                    typedef const Word& reference;
+
+                    iterator()
+                        : expansion_(NULL), index_(0)
+                    {}
+
+                    reference operator*() const
+                        { return word_; }
+                    pointer operator->() const
+                        { return &word_; }
+
+                    iterator& operator++()
+                    {
+                        ++index_;
+                        generate();
+                        return *this;
+                    }
+
+                    iterator operator++(int)
+                    {
+                        iterator previous(*this);
+                        ++*this;
+                        return previous;
+                    }
+
+                    bool operator==(const iterator& other) const
+                        { return index_ == other.index_; }
+                    bool operator!=(const iterator& other) const
+                        { return index_ != other.index_; }
+
+                private:
+                    friend class BraceExpansion;
+
+                    const BraceExpansion* expansion_;
+                    std::size_t index_;
+                    Word word_;
+
+                    iterator(const BraceExpansion* expansion,
+                        std::size_t index)
+                        : expansion_(expansion), index_(index)
+                    { generate(); }
+
+                    void generate();
+            };
+
+            BraceExpansion(const std::string& pattern,
+                const QuotedRanges& quoted = QuotedRanges(),
+                std::size_t limit = DEFAULT_LIMIT);
+
+            iterator begin() const
+                { return iterator(this, 0); }
+            iterator end() const
+                { return iterator(this, size_); }
+
+            std::size_t size() const
+                { return size_; }
+
+        private:
+            struct Node
+            {
+                enum TypeOfNode
+                {
+                    TEXT,           // Characters of the pattern
+                    LIST,           // Alternatives are sequences
+                    RANGE
+                };
+
+                TypeOfNode type;
+                std::size_t begin;
+                std::size_t end;
+                std::vector<std::size_t> alternatives;
+                long long first;
+                long long step;
+                int width;          // Zero padding of numeric ranges
+                bool isAlphabetic;
+                std::size_t size;
+            };
+
+            typedef std::vector<std::size_t> SequenceType;
+
+            std::string pattern_;
+            QuotedRanges quoted_;
+            std::vector<Node> nodes_;
+            std::vector<SequenceType> sequences_;
+            std::vector<std::size_t> sequenceSizes_;
+            std::size_t root_;
+            std::size_t size_;
+
+            std::size_t parse(std::size_t begin, std::size_t end,
+                const std::vector<bool>& quoted);
+            bool parseRange(std::size_t begin, std::size_t end,
+                Node& node) const;
+            void generate(std::size_t sequence, std::size_t index,
+                Word& word) const;
+            void appendText(std::size_t begin, std::size_t end,
+                Word& word) const;
+    };
+
+    inline void BraceExpansion::iterator::generate()
+    {
+        if (expansion_ != NULL && index_ < expansion_->size_) {
+            word_.text.clear();
+            word_.quoted.clear();
+            expansion_->generate(expansion_->root_, index_, word_);
         }
-        return pathNames;
     }
 
     //
@@ -158,4 +806,10 @@ namespace glob
     }
 }
 
+namespace std
+{
+    template <>
+    struct is_error_code_enum<glob::GlobError> : public true_type {};
+}
+
 #endif /* GLOB_HPP_ */
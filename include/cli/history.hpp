@@ -0,0 +1,215 @@
+/*
+ * history.hpp - Persistent command history
+ *
+ *   Copyright 2010-2016 Jesús Torres <jmtorres@ull.es>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HISTORY_HPP_
+#define HISTORY_HPP_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/types.h>
+
+namespace cli { namespace history
+{
+    //
+    // Class HistoryIndex
+    //
+    // Trigram index over history entries. Queries only verify the entries
+    // that contain every trigram of the query, so they do not depend on the
+    // size of the history. Queries shorter than a trigram scan the entries,
+    // newest first, until enough matches are found.
+    //
+
+    class HistoryIndex
+    {
+        public:
+            enum class MatchType
+            {
+                SUBSTRING,
+                PREFIX
+            };
+
+            static const std::size_t DEFAULT_COUNT = 10;
+
+            void add(const std::string& entry);
+
+            //
+            // Return the positions of up to 'count' different entries
+            // matching 'query', newest first. Only the entries before the
+            // position 'before' are considered.
+            //
+
+            std::vector<std::size_t> search(const std::string& query,
+                MatchType type = MatchType::SUBSTRING,
+                std::size_t count = DEFAULT_COUNT,
+                std::size_t before = static_cast<std::size_t>(-1)) const;
+
+            const std::string& entry(std::size_t position) const
+                { return entries_[position]; }
+            std::size_t size() const
+                { return entries_.size(); }
+
+        private:
+            typedef std::uint32_t Trigram;
+
+            std::vector<std::string> entries_;
+            std::unordered_map<Trigram, std::vector<std::uint32_t> >
+                postings_;
+
+            static Trigram trigramAt(const std::string& text, std::size_t i);
+            static bool isMatch(const std::string& entry,
+                const std::string& query, MatchType type);
+    };
+
+    //
+    // Class HistoryStore
+    //
+    // History file where every line is appended with one write() as soon
+    // as it is entered, so nothing is lost if the program crashes. Several
+    // processes can share the same file. Every entry is preceded by a line
+    // with its timestamp, like '#1476000000'.
+    //
+    // Only the last lines of the file are kept in memory. They are read
+    // from the end of the file mapped in memory the first time they are
+    // requested.
+    //
+    // A background thread, started with startCompaction(), collects the
+    // entries appended by other processes and compacts the file when it
+    // doubles its size, removing duplicated entries but the most recent
+    // one. The file is rewritten in a temporary file that replaces the old
+    // one atomically. The collected entries are added to the entries in
+    // memory and to the index by mergeEntries(), which must be invoked from
+    // the thread that uses the store.
+    //
+    // Every process locks a file named like the history file plus '.lock'
+    // while the history file is written or read. The compaction opens the
+    // lock file again, because flock() locks taken through the same open
+    // file are not exclusive among them.
+    //
+    // The constructor throws std::system_error if the file can not be open.
+    //
+
+    class HistoryStore
+    {
+        public:
+            static const std::size_t DEFAULT_WINDOW_SIZE = 1000;
+            static const std::size_t DEFAULT_MAX_ENTRIES = 100000;
+            static const std::chrono::seconds DEFAULT_COMPACTION_INTERVAL;
+
+            HistoryStore(const std::string& fileName,
+                std::size_t windowSize = DEFAULT_WINDOW_SIZE);
+            ~HistoryStore();
+
+            HistoryStore(const HistoryStore&) = delete;
+            HistoryStore& operator=(const HistoryStore&) = delete;
+
+            //
+            // Append a line to the history. If it can not be written in
+            // the file, it is kept in memory anyway and std::system_error
+            // is thrown.
+            //
+
+            void append(const std::string& line);
+
+            //
+            // Last lines of the history, oldest first
+            //
+
+            const std::deque<std::string>& entries();
+
+            //
+            // Index over the whole history file. It is built the first
+            // time it is requested and updated with every line appended.
+            //
+
+            const HistoryIndex& index();
+
+            //
+            // Members to keep the history file compacted and merged with the
+            // entries of other processes
+            //
+
+            void startCompaction(std::chrono::seconds interval =
+                DEFAULT_COMPACTION_INTERVAL,
+                std::size_t maxEntries = DEFAULT_MAX_ENTRIES);
+            void stopCompaction();
+            void compact();
+
+            std::vector<std::string> mergeEntries();
+
+            const std::string& fileName() const
+                { return fileName_; }
+            std::size_t windowSize() const
+                { return windowSize_; }
+
+        private:
+            struct Entry
+            {
+                std::time_t timestamp;
+                std::string line;
+            };
+
+            std::string fileName_;
+            std::string lockFileName_;
+            std::size_t windowSize_;
+            int fd_;
+            int lockFd_;
+            int compactionLockFd_;
+
+            std::deque<std::string> window_;
+            bool isLoaded_;
+            std::unique_ptr<HistoryIndex> index_;
+
+            // Shared with the compaction thread
+            std::mutex mutex_;
+            std::condition_variable condition_;
+            std::deque<std::string> ownEntries_;
+            std::vector<std::string> mergedEntries_;
+            bool isCompactionStopping_;
+            std::thread compactionThread_;
+            std::mutex compactionMutex_;
+            std::size_t maxEntries_;
+
+            // Guarded by compactionMutex_
+            ino_t mergeInode_;
+            off_t mergeOffset_;
+            std::time_t mergeTimestamp_;
+            off_t compactedSize_;
+
+            void load();
+            void loadIndex();
+            void reopenIfReplaced();
+
+            void compactionLoop(std::chrono::seconds interval);
+            void collectEntries();
+            void collectEntries(int fd, off_t begin, off_t end,
+                std::time_t minTimestamp);
+    };
+}}
+
+#endif /* HISTORY_HPP_ */
@@ -0,0 +1,163 @@
+/*
+ * memoize.hpp - Cache of the results of commands without side effects
+ *
+ *   Copyright 2010-2016 Jesús Torres <jmtorres@ull.es>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MEMOIZE_HPP_
+#define MEMOIZE_HPP_
+
+#include <cstddef>
+#include <list>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace cli { namespace memoize
+{
+    //
+    // Functions to build the keys of the cache. Every value is appended in
+    // a way that two different sequences of values never give the same key.
+    // Overloads for other types must be declared in the namespace of the
+    // type, so they can be found by argument-dependent lookup.
+    //
+
+    inline void appendKey(std::string& key, const std::string& value)
+    {
+        key += std::to_string(value.size());
+        key += ':';
+        key += value;
+    }
+
+    template <typename T>
+    typename std::enable_if<std::is_arithmetic<T>::value ||
+        std::is_enum<T>::value>::type
+    appendKey(std::string& key, T value)
+    {
+        key += std::to_string(static_cast<long long>(value));
+        key += ';';
+    }
+
+    template <typename T, typename Alloc>
+    void appendKey(std::string& key, const std::vector<T, Alloc>& values)
+    {
+        key += std::to_string(values.size());
+        key += '[';
+        for (typename std::vector<T, Alloc>::const_iterator i =
+            values.begin(); i < values.end(); ++i)
+        {
+            appendKey(key, *i);
+        }
+    }
+
+    //
+    // Append the modification time and size of every file in 'paths', so
+    // the cached results are discarded when they change
+    //
+
+    void appendDependenciesKey(std::string& key,
+        const std::vector<std::string>& paths);
+
+    //
+    // Class CachedResult
+    //
+
+    struct CachedResult
+    {
+        std::string output;
+        bool isFinished;
+    };
+
+    //
+    // Class ResultCache
+    //
+    // LRU cache of command results. The size of the keys and the outputs
+    // stored is kept below the budget by discarding the least recently used
+    // results.
+    //
+
+    class ResultCache
+    {
+        public:
+            static const std::size_t DEFAULT_BUDGET = 1024 * 1024;
+
+            ResultCache(std::size_t budget = DEFAULT_BUDGET);
+
+            bool lookup(const std::string& key, CachedResult& result);
+            void insert(const std::string& key, const CachedResult& result);
+            void clear();
+
+            void budget(std::size_t budget);
+            std::size_t budget() const;
+
+            //
+            // Statistics
+            //
+
+            std::size_t size() const;
+            unsigned long long hits() const;
+            unsigned long long misses() const;
+
+        private:
+            typedef std::list<std::pair<std::string, CachedResult> >
+                EntriesType;
+
+            mutable std::mutex mutex_;
+            EntriesType entries_;   // Most recently used first
+            std::unordered_map<std::string, EntriesType::iterator> index_;
+            std::size_t budget_;
+            std::size_t size_;
+            unsigned long long hits_;
+            unsigned long long misses_;
+
+            void shrink(std::size_t budget);
+    };
+
+    //
+    // Class CaptureBuffer
+    //
+    // Stream buffer which writes in another stream buffer and keeps a copy
+    // of everything written.
+    //
+
+    class CaptureBuffer : public std::streambuf
+    {
+        public:
+            CaptureBuffer(std::streambuf* buffer)
+                : buffer_(buffer)
+            {}
+
+            std::streambuf* target() const
+                { return buffer_; }
+            const std::string& captured() const
+                { return captured_; }
+
+        protected:
+            virtual int_type overflow(int_type c);
+            virtual std::streamsize xsputn(const char_type* s,
+                std::streamsize n);
+            virtual int sync();
+
+        private:
+            std::streambuf* buffer_;
+            std::string captured_;
+    };
+}}
+
+#endif /* MEMOIZE_HPP_ */
@@ -19,9 +19,7 @@
 #ifndef PRETTYPRINT_HPP_
 #define PRETTYPRINT_HPP_
 
-#include <algorithm>
 #include <ostream>
-#include <string>
 
 #include <cli/chart_literal.hpp>
 #include <cli/detail/prettyprint.hpp>
@@ -35,7 +33,8 @@ namespace cli { namespace prettyprint
     template <typename CharT, typename Traits>
     bool isPrettyprintEnabled(std::basic_ostream<CharT, Traits>& os)
     {
-        return (os.iword(detail::PRETTYPRINT_ENABLED_FLAG_INDEX) != 0);
+        return (os.iword(detail::STATE_INDEX) &
+            detail::PRETTYPRINT_ENABLED_FLAG) != 0;
     }
 
     //
@@ -46,9 +45,10 @@ namespace cli { namespace prettyprint
     std::basic_ostream<CharT, Traits>& prettyprint(
         std::basic_ostream<CharT, Traits>& os)
     {
-        os.iword(detail::PRETTYPRINT_ENABLED_FLAG_INDEX) = true;
-        os.iword(detail::INDENT_SPACE_INDEX) = 0;
-        os.iword(detail::INDENT_WIDTH_INDEX) = detail::INDENT_DEFAULT_WIDTH;
+        long& state = os.iword(detail::STATE_INDEX);
+        state = detail::setIndentWidth(
+            (state & detail::BUFFERED_FLAG) | detail::PRETTYPRINT_ENABLED_FLAG,
+            detail::INDENT_DEFAULT_WIDTH);
         return os;
     }
 
@@ -56,7 +56,30 @@ namespace cli { namespace prettyprint
     std::basic_ostream<CharT, Traits>& noprettyprint(
         std::basic_ostream<CharT, Traits>& os)
     {
-        os.iword(detail::PRETTYPRINT_ENABLED_FLAG_INDEX) = false;
+        os.iword(detail::STATE_INDEX) &= ~detail::PRETTYPRINT_ENABLED_FLAG;
+        return os;
+    }
+
+    //
+    // Manipulators to enable and disable buffered mode. In buffered mode
+    // endl and the rest of end-of-line manipulators do not flush the stream.
+    // The command-line interpreters flush their output stream after every
+    // command.
+    //
+
+    template <typename CharT, typename Traits>
+    std::basic_ostream<CharT, Traits>& buffered(
+        std::basic_ostream<CharT, Traits>& os)
+    {
+        os.iword(detail::STATE_INDEX) |= detail::BUFFERED_FLAG;
+        return os;
+    }
+
+    template <typename CharT, typename Traits>
+    std::basic_ostream<CharT, Traits>& nobuffered(
+        std::basic_ostream<CharT, Traits>& os)
+    {
+        os.iword(detail::STATE_INDEX) &= ~detail::BUFFERED_FLAG;
         return os;
     }
 
@@ -68,8 +91,9 @@ namespace cli { namespace prettyprint
     std::basic_ostream<CharT, Traits>& indent(
         std::basic_ostream<CharT, Traits>& os)
     {
-        os.iword(detail::INDENT_SPACE_INDEX) +=
-            os.iword(detail::INDENT_WIDTH_INDEX);
+        long& state = os.iword(detail::STATE_INDEX);
+        state = detail::setIndentSpace(state,
+            detail::indentSpace(state) + detail::indentWidth(state));
         return os;
     }
 
@@ -77,9 +101,9 @@ namespace cli { namespace prettyprint
     std::basic_ostream<CharT, Traits>& deindent(
         std::basic_ostream<CharT, Traits>& os)
     {
-        int space = os.iword(detail::INDENT_SPACE_INDEX) -
-            os.iword(detail::INDENT_WIDTH_INDEX);
-        os.iword(detail::INDENT_SPACE_INDEX) = std::max(space, 0);
+        long& state = os.iword(detail::STATE_INDEX);
+        state = detail::setIndentSpace(state,
+            detail::indentSpace(state) - detail::indentWidth(state));
         return os;
     }
 
@@ -96,7 +120,10 @@ namespace cli { namespace prettyprint
             {}
 
             void operator()(std::basic_ostream<CharT, Traits>& os) const
-                { os.iword(detail::INDENT_WIDTH_INDEX) = width_; }
+            {
+                long& state = os.iword(detail::STATE_INDEX);
+                state = detail::setIndentWidth(state, width_);
+            }
 
         private:
             int width_;
@@ -125,12 +152,7 @@ namespace cli { namespace prettyprint
     std::basic_ostream<CharT, Traits>& endl(
         std::basic_ostream<CharT, Traits>& os)
     {
-        os << std::endl;
-        if (isPrettyprintEnabled(os)) {
-            os << std::basic_string<CharT>(
-                os.iword(detail::INDENT_SPACE_INDEX),
-                CHART_LITERAL(CharT, ' '));
-        }
+        detail::newLine(os, os.iword(detail::STATE_INDEX));
         return os;
     }
 
@@ -143,7 +165,10 @@ namespace cli { namespace prettyprint
     std::basic_ostream<CharT, Traits>& endlAndIndent(
         std::basic_ostream<CharT, Traits>& os)
     {
-        os << indent << endl;
+        long& state = os.iword(detail::STATE_INDEX);
+        state = detail::setIndentSpace(state,
+            detail::indentSpace(state) + detail::indentWidth(state));
+        detail::newLine(os, state);
         return os;
     }
 
@@ -156,7 +181,10 @@ namespace cli { namespace prettyprint
     std::basic_ostream<CharT, Traits>& endlAndDeindent(
         std::basic_ostream<CharT, Traits>& os)
     {
-        os << deindent << endl;
+        long& state = os.iword(detail::STATE_INDEX);
+        state = detail::setIndentSpace(state,
+            detail::indentSpace(state) - detail::indentWidth(state));
+        detail::newLine(os, state);
         return os;
     }
 }}
@@ -24,6 +24,7 @@
 //#include <readline/history.h>
 //#endif
 
+#include <cstddef>
 #include <cstdio>
 #include <functional>
 #include <iostream>
@@ -31,6 +32,7 @@
 #include <string>
 
 #include <cli/dl.hpp>
+#include <cli/history.hpp>
 
 namespace cli { namespace readline
 {
@@ -55,6 +57,7 @@ namespace cli { namespace readline
             void readHistory(const std::string& fileName);
             void writeHistory(const std::string& fileName);
             void clearHistory();
+            void stifleHistory(int max);
 
             //
             // Readline library I/O streams setters
@@ -63,20 +66,67 @@ namespace cli { namespace readline
             void inStream(std::istream& in);
             void outStream(std::ostream& out);
 
+            //
+            // Readline library alternate interface wrappers. The handler
+            // receives NULL at the end of the input. Only one handler can
+            // be installed at a time in the whole process.
+            //
+
+            void callbackHandlerInstall(const std::string& prompt,
+                const std::function<void (char*)>& handler);
+            void callbackReadChar();
+            void callbackHandlerRemove();
+            void setPrompt(const std::string& prompt);
+
+            //
+            // Readline library key binding and line editing wrappers
+            //
+
+            typedef int (CommandSignature)(int, int);
+
+            void bindKeySequence(const std::string& keySequence,
+                CommandSignature* function);
+            std::string lineBuffer();
+            void replaceLine(const std::string& text);
+
         private:
+            typedef void (LineHandlerSignature)(char*);
+
             std::function<char* (const char*)> readline_;
             std::function<void (const char*)> add_history_;
             std::function<int (const char*)> read_history_;
             std::function<int (const char*)> write_history_;
             std::function<void ()> clear_history_;
+            std::function<void (int)> stifle_history_;
+            std::function<void (const char*, LineHandlerSignature*)>
+                rl_callback_handler_install_;
+            std::function<void ()> rl_callback_read_char_;
+            std::function<void ()> rl_callback_handler_remove_;
+            std::function<int (const char*)> rl_set_prompt_;
+            std::function<int (const char*, CommandSignature*)>
+                rl_bind_keyseq_;
+            std::function<void (const char*, int)> rl_replace_line_;
 
             FILE** rl_instream_;
             FILE** rl_outstream_;
+            char** rl_line_buffer_;
+            int* rl_point_;
+
+            std::function<void (char*)> lineHandler_;
+
+            static ReadlineLibrary* lineHandlerObject_;
+            static void lineHandler(char* line);
     };
 
+    class FileLineReader;
+
     //
     // Class Readline
     //
+    // When the readline library is not used, lines are read directly from
+    // the file descriptor of the input stream, if it has one, and the
+    // prompt is only shown if it is a terminal.
+    //
 
     class Readline
     {
@@ -92,6 +142,26 @@ namespace cli { namespace readline
             bool isUsingLibrary()
                 { return static_cast<bool>(readlineLibrary_); }
 
+            //
+            // Non-blocking interface to be used from event loops.
+            // startReading() shows the prompt and readAvailable() must be
+            // invoked when the input stream descriptor is readable. The
+            // handler is invoked for every line read and it can return true
+            // to stop reading. readAvailable() returns false at the end of
+            // the input or when reading was stopped. The prompt can be
+            // changed from the handler to be shown for the next line.
+            //
+
+            typedef std::function<bool (const std::string&)> LineHandler;
+
+            void startReading(const std::string& prompt,
+                const LineHandler& handler);
+            bool readAvailable();
+            void stopReading();
+            void prompt(const std::string& prompt);
+
+            int inDescriptor() const;
+
             //
             // I/O streams setters
             //
@@ -102,17 +172,60 @@ namespace cli { namespace readline
             //
             // History management
             //
+            // Every line read is appended to the history file at once.
+            // Only the last lines of the file are loaded in the history of
+            // the readline library. historyFile() throws std::system_error
+            // if the file can not be open.
+            //
 
             void historyFile(const std::string &fileName,
                 bool loadInHistory = true);
             void clearHistory();
 
+            cli::history::HistoryStore* historyStore() const
+                { return historyStore_.get(); }
+
+            //
+            // Bind a key sequence, in readline inputrc syntax, to replace
+            // the line being edited with the newest history entry that
+            // contains it. Pressing it again goes to the next older entry.
+            // It requires the readline library and a history file.
+            //
+
+            void bindHistorySearch(const std::string& keySequence);
+
+            //
+            // Errors writing the history file are not thrown while lines
+            // are read, so no line is lost. takeHistoryError() returns the
+            // description of the last one, or an empty string, and clears
+            // it.
+            //
+
+            std::string takeHistoryError();
+
         private:
             std::unique_ptr<ReadlineLibrary> readlineLibrary_;
+            std::unique_ptr<FileLineReader> fileLineReader_;
             std::istream* in_;
             std::ostream* out_;
+            bool isInteractive_;
+
+            std::string prompt_;
+            LineHandler lineHandler_;
+            bool isReading_;
+
+            std::unique_ptr<cli::history::HistoryStore> historyStore_;
+            mutable std::string historyError_;
+
+            std::string searchQuery_;
+            std::string searchMatch_;
+            std::size_t searchPosition_;
+
+            static Readline* historySearchObject_;
+            static int historySearch(int count, int key);
 
-            std::string historyFileName_;
+            void addHistory(const std::string& line) const;
+            void mergeHistory() const;
     };
 }}
 
@@ -0,0 +1,230 @@
+/*
+ * script.hpp - Support for interpreting script files
+ *
+ *   Copyright 2010-2016 Jesús Torres <jmtorres@ull.es>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SCRIPT_HPP_
+#define SCRIPT_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace cli { namespace script
+{
+    //
+    // Class MappedFile
+    //
+    // Read-only memory mapping of a whole file, advised for sequential
+    // access. Files which can not be mapped, like pipes or terminals, are
+    // read into memory until the end of file instead. The constructor
+    // throws std::system_error if the file can not be mapped nor read.
+    //
+
+    class MappedFile
+    {
+        public:
+            MappedFile(const std::string& fileName);
+            ~MappedFile();
+
+            MappedFile(const MappedFile&) = delete;
+            MappedFile& operator=(const MappedFile&) = delete;
+
+            const char* begin() const
+                { return data_; }
+            const char* end() const
+                { return data_ + size_; }
+            std::size_t size() const
+                { return size_; }
+
+        private:
+            const char* data_;
+            std::size_t size_;
+            bool isMapped_;
+            std::string buffer_;
+
+            void read(int fd, const std::string& fileName);
+    };
+
+    //
+    // Class LineSplitter
+    //
+    // Splits a buffer into lines without copying it. The line terminators
+    // are not included in the lines returned.
+    //
+
+    class LineSplitter
+    {
+        public:
+            LineSplitter(const char* begin, const char* end)
+                : current_(begin), end_(end)
+            {}
+
+            bool nextLine(const char*& begin, const char*& end)
+            {
+                if (current_ == end_) {
+                    return false;
+                }
+
+                const char* newline = static_cast<const char*>(
+                    std::memchr(current_, '\n', end_ - current_));
+                begin = current_;
+                if (newline == NULL) {
+                    end = end_;
+                    current_ = end_;
+                }
+                else {
+                    end = newline;
+                    current_ = newline + 1;
+                }
+                return true;
+            }
+
+        private:
+            const char* current_;
+            const char* end_;
+    };
+
+    //
+    // Class PrefetchRing
+    //
+    // Bounded lock-free ring shared by one producer and one consumer
+    // thread. The slots are filled and used in place, so the elements are
+    // never copied and their memory is reused. The waiting side spins for
+    // a while, because the other side is usually much faster. Then it
+    // blocks on a condition variable until the other side pushes, pops or
+    // closes, so a long command does not keep the reader waking up. The
+    // mutex is only taken when some side is blocked.
+    //
+
+    template <typename T>
+    class PrefetchRing
+    {
+        public:
+            static const std::size_t DEFAULT_SIZE = 64;
+
+            PrefetchRing(std::size_t size = DEFAULT_SIZE)
+                : slots_(size), head_(0), tail_(0), isClosed_(false),
+                  sleepers_(0)
+            {}
+
+            PrefetchRing(const PrefetchRing&) = delete;
+            PrefetchRing& operator=(const PrefetchRing&) = delete;
+
+            //
+            // Producer interface. pushSlot() waits for a free slot, to be
+            // filled and then published with push(). It returns NULL if
+            // the consumer closed the ring.
+            //
+
+            T* pushSlot()
+            {
+                std::size_t tail = tail_.load(std::memory_order_relaxed);
+                waitFor([this, tail]() {
+                    return isClosed_.load() ||
+                        tail - head_.load() < slots_.size();
+                });
+                return isClosed_.load() ? NULL : &slots_[tail % slots_.size()];
+            }
+
+            void push()
+            {
+                tail_.fetch_add(1);
+                wake();
+            }
+
+            //
+            // Consumer interface. popSlot() waits for a published slot,
+            // which is given back to the producer with pop().
+            //
+
+            T* popSlot()
+            {
+                std::size_t head = head_.load(std::memory_order_relaxed);
+                waitFor([this, head]() { return tail_.load() != head; });
+                return &slots_[head % slots_.size()];
+            }
+
+            void pop()
+            {
+                head_.fetch_add(1);
+                wake();
+            }
+
+            void close()
+            {
+                isClosed_.store(true);
+                wake();
+            }
+            bool isClosed() const
+                { return isClosed_.load(std::memory_order_acquire); }
+
+        private:
+            static const unsigned SPINS_BEFORE_YIELD = 64;
+            static const unsigned SPINS_BEFORE_BLOCK = 128;
+
+            std::vector<T> slots_;
+
+            // They are only increased, so every side owns one of them
+            std::atomic<std::size_t> head_;
+            std::atomic<std::size_t> tail_;
+            std::atomic<bool> isClosed_;
+
+            // Sides blocked on the condition variable. The counters and
+            // the flag are sequentially consistent, so either the waiting
+            // side sees the change or the other side sees it blocked.
+            std::atomic<unsigned> sleepers_;
+            std::mutex mutex_;
+            std::condition_variable condition_;
+
+            template <typename Predicate>
+            void waitFor(Predicate isReady)
+            {
+                for (unsigned spins = 0; spins < SPINS_BEFORE_BLOCK;
+                    ++spins)
+                {
+                    if (isReady()) {
+                        return;
+                    }
+                    if (spins >= SPINS_BEFORE_YIELD) {
+                        std::this_thread::yield();
+                    }
+                }
+
+                std::unique_lock<std::mutex> lock(mutex_);
+                sleepers_.fetch_add(1);
+                while (! isReady()) {
+                    condition_.wait(lock);
+                }
+                sleepers_.fetch_sub(1);
+            }
+
+            void wake()
+            {
+                if (sleepers_.load() > 0) {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    condition_.notify_all();
+                }
+            }
+    };
+}}
+
+#endif /* SCRIPT_HPP_ */
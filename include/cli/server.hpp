@@ -0,0 +1,106 @@
+/*
+ * server.hpp - Server of shell interpreter sessions over a local socket
+ *
+ *   Copyright 2010-2016 Jesús Torres <jmtorres@ull.es>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SERVER_HPP_
+#define SERVER_HPP_
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <cli/callbacks.hpp>
+#include <cli/shell.hpp>
+
+namespace cli { namespace server
+{
+    struct Session;
+
+    //
+    // Class ShellServer
+    //
+    // Accepts connections on a Unix domain socket and runs an independent
+    // ShellInterpreter for every client. The lines received are interpreted
+    // and everything written by the commands in the output and error
+    // streams of the interpreter is sent back to the client. Sessions are
+    // multiplexed through epoll over a fixed pool of worker threads, so
+    // commands of different sessions can run at the same time, but every
+    // session is handled by one thread at a time. Sessions which send lines
+    // longer than the interpreter maxLineLength() are closed.
+    //
+    // The constructor throws std::system_error if the socket can not be
+    // created.
+    //
+
+    class ShellServer
+    {
+        public:
+            ShellServer(const std::string& socketName,
+                unsigned workers = std::thread::hardware_concurrency());
+            ~ShellServer();
+
+            ShellServer(const ShellServer&) = delete;
+            ShellServer& operator=(const ShellServer&) = delete;
+
+            //
+            // Start the worker threads and stop them, closing all the
+            // sessions. run() starts the server and waits until stop() is
+            // invoked from other thread or from a command.
+            //
+
+            void start();
+            void stop();
+            void run();
+
+            std::size_t sessionCount() const;
+
+            //
+            // Accessors of callback functions
+            //
+            // onNewSession is invoked to set the callbacks of the
+            // interpreter of every new session. The commands must write in
+            // the streams returned by interpreter.out() and
+            // interpreter.err() to reach the client.
+            //
+
+            cli::callback::Callback<void, cli::ShellInterpreter&>
+                onNewSession;
+
+        private:
+            std::string socketName_;
+            int listenFd_;
+            int epollFd_;
+            int stopFd_;
+            unsigned workerCount_;
+            std::vector<std::thread> workers_;
+
+            mutable std::mutex mutex_;
+            std::unordered_map<int, std::unique_ptr<Session> > sessions_;
+
+            void worker();
+            void acceptSessions();
+            bool readSession(Session& session);
+            bool writeSession(Session& session);
+            void closeSession(Session& session);
+    };
+}}
+
+#endif /* SERVER_HPP_ */
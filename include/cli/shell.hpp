@@ -29,6 +29,7 @@
 #include <cli/basic_spirit.hpp>
 #include <cli/callbacks.hpp>
 #include <cli/glob.hpp>
+#include <cli/memoize.hpp>
 #include <cli/utility.hpp>
 
 namespace cli
@@ -68,6 +69,25 @@ namespace cli { namespace parser { namespace shellparser
         std::string argument;
     };
 
+    //
+    // Class Word
+    //
+    // Word to be expanded as a pattern. The parser sets 'isPattern' when
+    // the word has metacharacters of the pathname expansion which are not
+    // quoted nor escaped, so the rest of the words are not globbed. The
+    // quoted and escaped characters are kept in 'text' as they are, and
+    // their ranges in 'quoted'.
+    //
+
+    struct Word
+    {
+        std::string text;
+        glob::QuotedRanges quoted;
+        bool isPattern;
+
+        Word() : isPattern(false) {}
+    };
+
     struct Arguments
     {
         enum TypeOfTerminator
@@ -236,6 +256,79 @@ namespace cli { namespace parser { namespace shellparser
         return os << CHART_LITERAL(CharT, '}');
     }
 
+    //
+    // Overload appendKey() for class Arguments.
+    // It is required to cache the results of commands.
+    //
+
+    inline void appendKey(std::string& key,
+        const VariableAssignment& variable)
+    {
+        using cli::memoize::appendKey;
+        appendKey(key, variable.name);
+        appendKey(key, variable.value);
+    }
+
+    inline void appendKey(std::string& key,
+        const StdioRedirection& redirection)
+    {
+        using cli::memoize::appendKey;
+        appendKey(key, redirection.type);
+        appendKey(key, redirection.argument);
+    }
+
+    inline void appendKey(std::string& key, const Arguments& arguments)
+    {
+        using cli::memoize::appendKey;
+        appendKey(key, arguments.variables);
+        appendKey(key, arguments.arguments);
+        appendKey(key, arguments.redirections);
+        appendKey(key, arguments.terminator);
+    }
+
+    //
+    // Class LineContinuation
+    //
+    // Joins the lines of a command which continues in the next line because
+    // it ends with an escaped newline or a pipe, or because a quoted string
+    // is not terminated. The scanner state is kept between lines, so every
+    // line is scanned only once, whatever the length of the command.
+    //
+
+    class LineContinuation
+    {
+        public:
+            LineContinuation();
+
+            //
+            // Add the next line of the command. It returns true when the
+            // command is complete, which is left in 'line'.
+            //
+
+            bool append(std::string& line);
+
+            //
+            // Take the incomplete command, if any, and reset the scanner
+            //
+
+            void flush(std::string& line);
+
+            bool isPending() const
+                { return isPending_; }
+
+        private:
+            enum TypeOfQuote
+            {
+                NO_QUOTE,
+                SINGLE_QUOTE,
+                DOUBLE_QUOTE
+            };
+
+            std::string command_;
+            TypeOfQuote quote_;
+            bool isPending_;
+    };
+
     //
     // Class ShellParser
     //
@@ -301,11 +394,12 @@ namespace cli { namespace parser { namespace shellparser
         qi::rule<Iterator, char()> dereference;
         qi::rule<Iterator, char()> special;
         qi::rule<Iterator, char()> escape;
+        qi::rule<Iterator, char()> patternCharacter;
         qi::rule<Iterator, std::string()> name;
         qi::rule<Iterator, std::string(), qi::locals<bool> > variable;
         qi::rule<Iterator, std::string()> quotedString;
         qi::rule<Iterator, std::string()> doubleQuotedString;
-        qi::rule<Iterator, std::string()> word;
+        qi::rule<Iterator, Word()> word;
         qi::rule<Iterator, std::vector<std::string>()> expandedWord;
         qi::rule<Iterator, std::string()> variableValue;
         qi::rule<Iterator, void(bool)> unambiguousRedirection;
@@ -325,11 +419,15 @@ namespace cli { namespace parser { namespace shellparser
             // Auxiliary methods
             //
 
-            static std::string globEscape(const std::string& pattern)
-                { return glob::Glob::escape(pattern); }
+            static void appendQuoted(Word& word, const std::string& text);
+            static void appendQuotedCharacter(Word& word, char c)
+                { appendQuoted(word, std::string(1, c)); }
 
             static std::string stringsJoin(const std::vector<std::string>& v)
                 { return boost::algorithm::join(v, std::string(1, ' ')); }
+
+            static bool hasPatternCharacters(const std::string& value)
+                { return value.find_first_of("*?[{~") != std::string::npos; }
     };
 }}}
 
@@ -349,6 +447,15 @@ namespace cli
         {
             typedef ShellArguments ArgumentsType;
             typedef spiritparser::SpiritParseError ErrorType;
+
+            static std::vector<std::string> commandWords(
+                const ArgumentsType& arguments)
+            {
+                return arguments.arguments.empty() ?
+                    std::vector<std::string>() :
+                    std::vector<std::string>(arguments.arguments.begin() + 1,
+                        arguments.arguments.end());
+            }
         };
     }
 
@@ -378,7 +485,42 @@ namespace cli
             cli::callback::VariableLookupCallback onVariableLookup;
             cli::callback::PathnameExpansionCallback onPathnameExpansion;
 
+            //
+            // Cache of the directories read by the pathname expansion. It
+            // is shared by all the interpreters, so the sessions of a
+            // server use a single inotify instance.
+            //
+
+            static glob::DirectoryCache& directoryCache();
+
+            //
+            // Options of the pathname expansion, including the limits of
+            // entries visited, path names and time. Ctrl-C cancels the
+            // expansion if no cancellation token is set.
+            //
+
+            glob::GlobOptions& globOptions()
+                { return globOptions_; }
+
+            //
+            // Maximum number of words a brace expansion can generate
+            //
+
+            void braceExpansionLimit(std::size_t limit)
+                { braceExpansionLimit_ = limit; }
+            std::size_t braceExpansionLimit() const
+                { return braceExpansionLimit_; }
+
         private:
+            template <typename Iterator>
+            friend struct shellparser::ShellParser;
+
+            shellparser::LineContinuation lineContinuation_;
+            glob::GlobOptions globOptions_;
+            std::size_t braceExpansionLimit_;
+
+            virtual bool joinLine(std::string& line, bool isLastLine);
+            virtual bool isParseDeferred(const std::string& line) const;
 
             //
             // Hook methods invoked during parsing
@@ -386,7 +528,7 @@ namespace cli
 
             std::string variableLookup(const std::string& name);
             std::vector<std::string> pathnameExpansion(
-                const std::string& pattern);
+                const shellparser::Word& word);
     };
 }
 
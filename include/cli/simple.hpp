@@ -21,6 +21,7 @@
 #define COMMAND_HPP_
 
 #include <string>
+#include <vector>
 
 #include <cli/base.hpp>
 #include <cli/traits.hpp>
@@ -46,6 +47,9 @@ namespace cli
         {
             typedef std::string ArgumentsType;
             typedef std::string ErrorType;
+
+            static std::vector<std::string> commandWords(
+                const ArgumentsType& arguments);
         };
     }
 
@@ -0,0 +1,91 @@
+/*
+ * suggest.hpp - Suggestions of similar command names
+ *
+ *   Copyright 2010-2016 Jesús Torres <jmtorres@ull.es>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SUGGEST_HPP_
+#define SUGGEST_HPP_
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace cli { namespace suggest
+{
+    //
+    // Damerau-Levenshtein distance (Levenshtein distance plus transposition
+    // of adjacent characters) between two words. Unlike the optimal string
+    // alignment distance, it allows to edit the transposed characters
+    // again, so it is a metric, as BKTree requires.
+    //
+
+    unsigned editDistance(const std::string& a, const std::string& b);
+
+    //
+    // Class BKTree
+    //
+    // Burkhard-Keller tree over the edit distance. Words can be added at any
+    // time and searches only visit the subtrees that may contain words
+    // within the requested distance.
+    //
+
+    class BKTree
+    {
+        public:
+            static const unsigned DEFAULT_MAX_DISTANCE = 2;
+            static const std::size_t DEFAULT_COUNT = 3;
+            static const std::chrono::microseconds DEFAULT_BUDGET;
+
+            void insert(const std::string& word);
+
+            //
+            // Return up to 'count' words at most 'maxDistance' edits away
+            // from 'word', nearest first. The search stops when 'budget' is
+            // exhausted, returning the best words found so far.
+            //
+
+            std::vector<std::string> search(const std::string& word,
+                unsigned maxDistance = DEFAULT_MAX_DISTANCE,
+                std::size_t count = DEFAULT_COUNT,
+                std::chrono::microseconds budget = DEFAULT_BUDGET) const;
+
+            std::size_t size() const
+                { return nodes_.size(); }
+
+            bool empty() const
+                { return nodes_.empty(); }
+
+        private:
+            struct Node
+            {
+                std::string word;
+                std::vector<std::pair<unsigned, std::size_t> > children;
+            };
+
+            std::vector<Node> nodes_;
+    };
+
+    //
+    // Names of the executable files found in the directories listed in the
+    // PATH environment variable
+    //
+
+    std::vector<std::string> pathExecutables();
+}}
+
+#endif /* SUGGEST_HPP_ */
@@ -21,6 +21,22 @@
 
 namespace cli { namespace traits
 {
+    //
+    // Class ParserTraits
+    //
+    // Specializations must define:
+    //
+    //  ArgumentsType   Type of the arguments returned by the parser.
+    //  ErrorType       Type of the errors returned by the parser.
+    //
+    // and, to be used with CommandLineInterpreterBase::registerCommand():
+    //
+    //  static std::vector<std::string> commandWords(
+    //      const ArgumentsType& arguments);
+    //
+    // which returns the command arguments, without the command name.
+    //
+
     template <typename Parser>
     struct ParserTraits
     {};
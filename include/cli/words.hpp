@@ -89,6 +89,14 @@ namespace cli
         {
             typedef WordsArguments ArgumentsType;
             typedef spiritparser::SpiritParseError ErrorType;
+
+            static std::vector<std::string> commandWords(
+                const ArgumentsType& arguments)
+            {
+                return arguments.empty() ? std::vector<std::string>() :
+                    std::vector<std::string>(arguments.begin() + 1,
+                        arguments.end());
+            }
         };
     }
 
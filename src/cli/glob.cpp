@@ -18,61 +18,2681 @@
 
 #define BOOST_ERROR_CODE_HEADER_ONLY
 
+#include <algorithm>
+#include <atomic>
+#include <bitset>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
-namespace glob {
-    // onGlobError() must be declared before declaring Glob class
-    extern "C" int onGlobError(const char *epath, int eerrno);
-}
+#include <dirent.h>
+#include <fcntl.h>
+#include <pwd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <cli/glob.hpp>
+#include <cli/script.hpp>
+
+namespace glob
+{
+    namespace
+    {
+        //
+        // Flags of the GNU extensions
+        //
+
+#if defined(_GNU_SOURCE)
+        const int PERIOD_FLAG = GLOB_PERIOD;
+        const int ONLYDIR_FLAG = GLOB_ONLYDIR;
+        const int BRACE_FLAG = GLOB_BRACE;
+        const int NOMAGIC_FLAG = GLOB_NOMAGIC;
+        const int TILDE_FLAG = GLOB_TILDE;
+        const int TILDE_CHECK_FLAG = GLOB_TILDE_CHECK;
+#else
+        const int PERIOD_FLAG = 0;
+        const int ONLYDIR_FLAG = 0;
+        const int BRACE_FLAG = 0;
+        const int NOMAGIC_FLAG = 0;
+        const int TILDE_FLAG = 0;
+        const int TILDE_CHECK_FLAG = 0;
+#endif /* _GNU_SOURCE */
+
+        const int RECURSIVE_FLAG =
+            static_cast<int>(GlobFlags::EXPAND_RECURSIVE_WILDCARD);
+
+        //
+        // Directory entries returned by getdents64()
+        //
+
+        struct LinuxDirent64
+        {
+            ino64_t d_ino;
+            off64_t d_off;
+            unsigned short d_reclen;
+            unsigned char d_type;
+            char d_name[];
+        };
+
+        const std::size_t DIRENTS_BUFFER_SIZE = 64 * 1024;
+
+        //
+        // Characters of a pattern which are taken literally because they
+        // were quoted. It is empty if no character was quoted.
+        //
+
+        typedef std::vector<bool> QuotedMask;
+
+        inline bool isQuoted(const QuotedMask& quoted, std::size_t i)
+        {
+            return i < quoted.size() && quoted[i];
+        }
+
+        QuotedMask makeQuotedMask(const QuotedRanges& ranges,
+            std::size_t size)
+        {
+            QuotedMask quoted;
+            for (QuotedRanges::const_iterator i = ranges.begin();
+                i < ranges.end(); ++i)
+            {
+                if (i->first < i->second && i->first < size) {
+                    quoted.resize(size);
+                    std::fill(quoted.begin() + i->first, quoted.begin() +
+                        std::min(i->second, size), true);
+                }
+            }
+            return quoted;
+        }
+
+        QuotedMask subMask(const QuotedMask& quoted, std::size_t begin,
+            std::size_t end)
+        {
+            if (begin >= quoted.size()) {
+                return QuotedMask();
+            }
+            return QuotedMask(quoted.begin() + begin,
+                quoted.begin() + std::min(end, quoted.size()));
+        }
+
+        //
+        // Functions to match path name components
+        //
+
+        bool isMagic(const std::string& pattern, const QuotedMask& quoted,
+            bool isEscapeEnabled)
+        {
+            for (std::string::size_type i = 0; i < pattern.size(); ++i) {
+                if (isQuoted(quoted, i)) {
+                    continue;
+                }
+                else if (pattern[i] == '\\' && isEscapeEnabled) {
+                    ++i;
+                }
+                else if (pattern[i] == '*' || pattern[i] == '?' ||
+                    pattern[i] == '[')
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        std::string unescape(const std::string& pattern,
+            const QuotedMask& quoted, bool isEscapeEnabled)
+        {
+            if (! isEscapeEnabled) {
+                return pattern;
+            }
+
+            std::string unescaped;
+            for (std::string::size_type i = 0; i < pattern.size(); ++i) {
+                if (pattern[i] == '\\' && ! isQuoted(quoted, i) &&
+                    i + 1 < pattern.size())
+                {
+                    ++i;
+                }
+                unescaped.push_back(pattern[i]);
+            }
+            return unescaped;
+        }
+
+        bool matchCharacterClass(const std::string& name, unsigned char c)
+        {
+            if (name == "alnum") return std::isalnum(c);
+            if (name == "alpha") return std::isalpha(c);
+            if (name == "blank") return std::isblank(c);
+            if (name == "cntrl") return std::iscntrl(c);
+            if (name == "digit") return std::isdigit(c);
+            if (name == "graph") return std::isgraph(c);
+            if (name == "lower") return std::islower(c);
+            if (name == "print") return std::isprint(c);
+            if (name == "punct") return std::ispunct(c);
+            if (name == "space") return std::isspace(c);
+            if (name == "upper") return std::isupper(c);
+            if (name == "xdigit") return std::isxdigit(c);
+            return false;
+        }
+
+        //
+        // Match the bracket expression which starts after the '[' at
+        // 'pattern'. It returns the end of the expression or NULL if it is
+        // not terminated, so the '[' must be taken literally. The quoted
+        // characters are members of the expression with no special meaning.
+        // 'isQuotedAt' tells if the character at a position was quoted.
+        //
+
+        template <typename IsQuotedAt>
+        const char* matchBracket(const char* pattern, const char* end,
+            unsigned char c, bool isEscapeEnabled, IsQuotedAt isQuotedAt,
+            bool& isMatch)
+        {
+            bool isNegated = false;
+            if (pattern < end && (*pattern == '!' || *pattern == '^') &&
+                ! isQuotedAt(pattern))
+            {
+                isNegated = true;
+                ++pattern;
+            }
+
+            bool isMatched = false;
+            const char* first = pattern;
+            while (pattern < end) {
+                if (isQuotedAt(pattern)) {
+                    isMatched |= (static_cast<unsigned char>(*pattern) == c);
+                    ++pattern;
+                    continue;
+                }
+
+                if (*pattern == ']' && pattern != first) {
+                    isMatch = (isMatched != isNegated);
+                    return pattern + 1;
+                }
+
+                if (*pattern == '[' && pattern + 1 < end &&
+                    pattern[1] == ':')
+                {
+                    const char* classEnd = pattern + 2;
+                    while (classEnd + 1 < end &&
+                        ! (classEnd[0] == ':' && classEnd[1] == ']'))
+                    {
+                        ++classEnd;
+                    }
+                    if (classEnd + 1 < end) {
+                        isMatched |= matchCharacterClass(
+                            std::string(pattern + 2, classEnd), c);
+                        pattern = classEnd + 2;
+                        continue;
+                    }
+                }
+
+                if (*pattern == '\\' && isEscapeEnabled &&
+                    pattern + 1 < end)
+                {
+                    ++pattern;
+                }
+                unsigned char low = *pattern++;
+                if (pattern + 1 < end && *pattern == '-' &&
+                    pattern[1] != ']' && ! isQuotedAt(pattern))
+                {
+                    ++pattern;
+                    if (*pattern == '\\' && isEscapeEnabled &&
+                        pattern + 1 < end)
+                    {
+                        ++pattern;
+                    }
+                    unsigned char high = *pattern++;
+                    isMatched |= (low <= c && c <= high);
+                }
+                else {
+                    isMatched |= (low == c);
+                }
+            }
+            return NULL;
+        }
+
+        //
+        // Match a component of a path name, as fnmatch() with FNM_PATHNAME
+        // and FNM_PERIOD does, unless 'isPeriodMatched' is true. The quoted
+        // characters are matched literally.
+        //
+
+        bool matchComponent(const std::string& pattern,
+            const QuotedMask& quoted, const char* name, bool isEscapeEnabled,
+            bool isPeriodMatched)
+        {
+            const char* p = pattern.data();
+            const char* pend = p + pattern.size();
+            auto isQuotedAt = [&](const char* c)
+            {
+                return isQuoted(quoted, c - pattern.data());
+            };
+            const char* n = name;
+            const char* nend = n + std::strlen(n);
+
+            // A leading period must be matched explicitly
+            const bool isLeadingPeriod = (*name == '.' && ! isPeriodMatched);
+
+            const char* starPattern = NULL;
+            const char* starName = NULL;
+            while (p < pend || n < nend) {
+                if (p < pend) {
+                    if (isQuotedAt(p)) {
+                        if (n < nend && *p == *n) {
+                            ++p;
+                            ++n;
+                            continue;
+                        }
+                    }
+                    else if (*p == '*') {
+                        if (n == name && isLeadingPeriod) {
+                            return false;
+                        }
+                        while (p < pend && *p == '*' && ! isQuotedAt(p)) {
+                            ++p;
+                        }
+                        starPattern = p;
+                        starName = n;
+                        continue;
+                    }
+                    else if (n < nend) {
+                        bool isWildcardAllowed =
+                            ! (n == name && isLeadingPeriod);
+
+                        if (*p == '?') {
+                            if (isWildcardAllowed) {
+                                ++p;
+                                ++n;
+                                continue;
+                            }
+                        }
+                        else if (*p == '[') {
+                            bool isMatch = false;
+                            const char* after = matchBracket(p + 1, pend,
+                                *n, isEscapeEnabled, isQuotedAt, isMatch);
+                            if (after == NULL) {
+                                if (*n == '[') {
+                                    ++p;
+                                    ++n;
+                                    continue;
+                                }
+                            }
+                            else if (isMatch && isWildcardAllowed) {
+                                p = after;
+                                ++n;
+                                continue;
+                            }
+                        }
+                        else {
+                            const char* literal = p;
+                            if (*p == '\\' && isEscapeEnabled &&
+                                p + 1 < pend)
+                            {
+                                ++literal;
+                            }
+                            if (*literal == *n) {
+                                p = literal + 1;
+                                ++n;
+                                continue;
+                            }
+                        }
+                    }
+                }
+
+                // Let the last '*' match one more character
+                if (starPattern != NULL && starName < nend) {
+                    p = starPattern;
+                    n = ++starName;
+                    continue;
+                }
+                return false;
+            }
+            return true;
+        }
+
+        //
+        // Class ComponentMatcher
+        //
+        // Component of a pattern compiled to match the names of a directory
+        // faster than matchComponent() does. Patterns with only literals
+        // and '*', like '*.log', are matched comparing the literals with
+        // memcmp() and memmem(), which are vectorized by the C library.
+        // Other patterns are split into tokens, with 256-bit tables for
+        // bracket expressions, and turned into a DFA over the classes of
+        // characters which the tokens tell apart. Long patterns or those
+        // whose DFA would be too big are matched by matchComponent().
+        //
+
+        class ComponentMatcher
+        {
+            public:
+                ComponentMatcher()
+                    : type_(BACKTRACKING),
+                      isLeadingPeriodLiteral_(false),
+                      isEscapeEnabled_(true)
+                {}
+
+                ComponentMatcher(const std::string& pattern,
+                    const QuotedMask& quoted, bool isEscapeEnabled);
+
+                bool match(const char* name, bool isPeriodMatched) const;
+
+            private:
+                enum TypeOfMatcher
+                {
+                    LITERALS,
+                    DFA,
+                    BACKTRACKING
+                };
+
+                struct Token
+                {
+                    enum TypeOfToken
+                    {
+                        CHARACTER,
+                        ANY,
+                        CLASS,
+                        STAR
+                    };
+
+                    TypeOfToken type;
+                    unsigned char character;
+                    std::bitset<256> members;   // Of CLASS
+
+                    bool isMatch(unsigned char c) const
+                    {
+                        return (type == CHARACTER) ? c == character :
+                            (type == CLASS) ? members[c] : true;
+                    }
+                };
+
+                typedef std::uint64_t StateType;    // Set of tokens
+
+                static const std::size_t MAX_DFA_TOKENS = 63;
+                static const std::size_t MAX_DFA_STATES = 256;
+                static const std::uint16_t DEAD_STATE = 0;
+                static const std::uint16_t START_STATE = 1;
+
+                TypeOfMatcher type_;
+                bool isLeadingPeriodLiteral_;
+
+                // LITERALS: the literals around every '*'
+                std::vector<std::string> literals_;
+
+                // DFA
+                unsigned char characterClasses_[256];
+                std::size_t classCount_;
+                std::vector<std::uint16_t> transitions_;
+                std::vector<bool> isAccepting_;
+
+                // BACKTRACKING
+                std::string pattern_;
+                QuotedMask quoted_;
+                bool isEscapeEnabled_;
+
+                void compileDfa(const std::vector<Token>& tokens);
+                bool matchLiterals(const char* name) const;
+        };
+
+        ComponentMatcher::ComponentMatcher(const std::string& pattern,
+            const QuotedMask& quoted, bool isEscapeEnabled)
+            : type_(BACKTRACKING),
+              isLeadingPeriodLiteral_(false),
+              classCount_(0),
+              pattern_(pattern),
+              quoted_(quoted),
+              isEscapeEnabled_(isEscapeEnabled)
+        {
+            const char* begin = pattern.data();
+            const char* end = begin + pattern.size();
+            auto isQuotedAt = [&](const char* c)
+            {
+                return isQuoted(quoted, c - begin);
+            };
+
+            // The syntax is that of matchComponent()
+            std::vector<Token> tokens;
+            bool isLiteral = true;
+            for (const char* p = begin; p < end;) {
+                Token token;
+                token.type = Token::CHARACTER;
+                token.character = *p;
+                if (isQuotedAt(p)) {
+                    ++p;
+                }
+                else if (*p == '*') {
+                    token.type = Token::STAR;
+                    while (p < end && *p == '*' && ! isQuotedAt(p)) {
+                        ++p;
+                    }
+                }
+                else if (*p == '?') {
+                    token.type = Token::ANY;
+                    ++p;
+                }
+                else if (*p == '[') {
+                    bool isMatch = false;
+                    const char* after = matchBracket(p + 1, end, 0,
+                        isEscapeEnabled, isQuotedAt, isMatch);
+                    if (after == NULL) {
+                        ++p;
+                    }
+                    else {
+                        token.type = Token::CLASS;
+                        for (unsigned c = 1; c < 256; ++c) {
+                            matchBracket(p + 1, end, c, isEscapeEnabled,
+                                isQuotedAt, isMatch);
+                            token.members[c] = isMatch;
+                        }
+                        p = after;
+                    }
+                }
+                else if (*p == '\\' && isEscapeEnabled && p + 1 < end) {
+                    token.character = p[1];
+                    p += 2;
+                }
+                else {
+                    ++p;
+                }
+
+                if (token.type == Token::ANY || token.type == Token::CLASS) {
+                    isLiteral = false;
+                }
+                tokens.push_back(token);
+            }
+
+            isLeadingPeriodLiteral_ = ! tokens.empty() &&
+                tokens[0].type == Token::CHARACTER &&
+                tokens[0].character == '.';
+
+            if (isLiteral) {
+                type_ = LITERALS;
+                literals_.push_back(std::string());
+                for (std::vector<Token>::const_iterator i = tokens.begin();
+                    i < tokens.end(); ++i)
+                {
+                    if (i->type == Token::STAR) {
+                        literals_.push_back(std::string());
+                    }
+                    else {
+                        literals_.back().push_back(i->character);
+                    }
+                }
+            }
+            else if (tokens.size() <= MAX_DFA_TOKENS) {
+                compileDfa(tokens);
+            }
+        }
+
+        void ComponentMatcher::compileDfa(const std::vector<Token>& tokens)
+        {
+            const std::size_t accept = tokens.size();
+
+            // Characters which every token matches or not alike belong to
+            // the same class
+            std::vector<StateType> signatures;
+            for (unsigned c = 0; c < 256; ++c) {
+                StateType signature = 0;
+                for (std::size_t i = 0; i < tokens.size(); ++i) {
+                    if (tokens[i].isMatch(c)) {
+                        signature |= StateType(1) << i;
+                    }
+                }
+                std::vector<StateType>::iterator j = std::find(
+                    signatures.begin(), signatures.end(), signature);
+                characterClasses_[c] = j - signatures.begin();
+                if (j == signatures.end()) {
+                    signatures.push_back(signature);
+                }
+            }
+            classCount_ = signatures.size();
+
+            // A '*' can match nothing, so its set includes the next token
+            auto closure = [&](StateType state)
+            {
+                for (std::size_t i = 0; i < tokens.size(); ++i) {
+                    if ((state & (StateType(1) << i)) &&
+                        tokens[i].type == Token::STAR)
+                    {
+                        state |= StateType(1) << (i + 1);
+                    }
+                }
+                return state;
+            };
+
+            std::vector<StateType> states;
+            std::unordered_map<StateType, std::uint16_t> index;
+            states.push_back(0);
+            states.push_back(closure(1));
+            index[states[DEAD_STATE]] = DEAD_STATE;
+            index[states[START_STATE]] = START_STATE;
+
+            for (std::size_t s = 0; s < states.size(); ++s) {
+                for (std::size_t k = 0; k < classCount_; ++k) {
+                    StateType next = 0;
+                    for (std::size_t i = 0; i < tokens.size(); ++i) {
+                        if ((states[s] & (StateType(1) << i)) &&
+                            (signatures[k] & (StateType(1) << i)))
+                        {
+                            next |= StateType(1) <<
+                                (tokens[i].type == Token::STAR ? i : i + 1);
+                        }
+                    }
+                    next = closure(next);
+
+                    std::unordered_map<StateType, std::uint16_t>::iterator
+                        j = index.find(next);
+                    if (j == index.end()) {
+                        if (states.size() == MAX_DFA_STATES) {
+                            transitions_.clear();
+                            return;
+                        }
+                        j = index.insert(std::make_pair(next,
+                            static_cast<std::uint16_t>(states.size()))).first;
+                        states.push_back(next);
+                    }
+                    transitions_.push_back(j->second);
+                }
+            }
+
+            for (std::vector<StateType>::const_iterator i = states.begin();
+                i < states.end(); ++i)
+            {
+                isAccepting_.push_back((*i & (StateType(1) << accept)) != 0);
+            }
+            type_ = DFA;
+        }
+
+        bool ComponentMatcher::match(const char* name,
+            bool isPeriodMatched) const
+        {
+            // A leading period must be matched explicitly
+            if (*name == '.' && ! isPeriodMatched &&
+                ! isLeadingPeriodLiteral_)
+            {
+                return false;
+            }
+
+            switch (type_) {
+            case LITERALS:
+                return matchLiterals(name);
+            case DFA:
+            {
+                std::uint16_t state = START_STATE;
+                for (const unsigned char* c =
+                    reinterpret_cast<const unsigned char*>(name); *c; ++c)
+                {
+                    state = transitions_[state * classCount_ +
+                        characterClasses_[*c]];
+                    if (state == DEAD_STATE) {
+                        return false;
+                    }
+                }
+                return isAccepting_[state];
+            }
+            default:
+                return matchComponent(pattern_, quoted_, name,
+                    isEscapeEnabled_, isPeriodMatched);
+            }
+        }
+
+        bool ComponentMatcher::matchLiterals(const char* name) const
+        {
+            std::size_t size = std::strlen(name);
+            const std::string& first = literals_.front();
+            const std::string& last = literals_.back();
+
+            if (literals_.size() == 1) {
+                return size == first.size() &&
+                    std::memcmp(name, first.data(), size) == 0;
+            }
+            if (size < first.size() + last.size() ||
+                std::memcmp(name, first.data(), first.size()) != 0 ||
+                std::memcmp(name + size - last.size(), last.data(),
+                    last.size()) != 0)
+            {
+                return false;
+            }
+
+            // The leftmost match of every literal between two '*' leaves
+            // the most room for the rest
+            const char* begin = name + first.size();
+            const char* end = name + size - last.size();
+            for (std::size_t i = 1; i + 1 < literals_.size(); ++i) {
+                const std::string& literal = literals_[i];
+#if defined(_GNU_SOURCE)
+                const char* found = static_cast<const char*>(::memmem(begin,
+                    end - begin, literal.data(), literal.size()));
+#else
+                const char* found = std::search(begin, end, literal.begin(),
+                    literal.end());
+                found = (found == end && ! literal.empty()) ? NULL : found;
+#endif /* _GNU_SOURCE */
+                if (found == NULL) {
+                    return false;
+                }
+                begin = found + literal.size();
+            }
+            return true;
+        }
+
+        //
+        // Expand the first brace expression of 'pattern' and, recursively,
+        // the rest of them in every alternative. It returns false if the
+        // pattern has no brace expression.
+        //
+
+        bool expandBraces(const std::string& pattern,
+            const QuotedMask& quoted, bool isEscapeEnabled,
+            std::vector<std::pair<std::string, QuotedMask> >& alternatives)
+        {
+            std::string::size_type begin = std::string::npos;
+            std::string::size_type end = std::string::npos;
+            std::vector<std::string::size_type> commas;
+
+            for (std::string::size_type i = 0; i < pattern.size(); ++i) {
+                if (isQuoted(quoted, i)) {
+                    continue;
+                }
+                if (pattern[i] == '\\' && isEscapeEnabled) {
+                    ++i;
+                    continue;
+                }
+                if (pattern[i] != '{') {
+                    continue;
+                }
+
+                // Look for the closing brace at the same depth
+                unsigned depth = 0;
+                commas.clear();
+                for (std::string::size_type j = i + 1; j < pattern.size();
+                    ++j)
+                {
+                    if (isQuoted(quoted, j)) {
+                        continue;
+                    }
+                    else if (pattern[j] == '\\' && isEscapeEnabled) {
+                        ++j;
+                    }
+                    else if (pattern[j] == '{') {
+                        ++depth;
+                    }
+                    else if (pattern[j] == ',' && depth == 0) {
+                        commas.push_back(j);
+                    }
+                    else if (pattern[j] == '}') {
+                        if (depth == 0) {
+                            end = j;
+                            break;
+                        }
+                        --depth;
+                    }
+                }
+                if (end != std::string::npos) {
+                    begin = i;
+                    break;
+                }
+            }
+
+            if (begin == std::string::npos) {
+                return false;
+            }
+
+            std::string prefix(pattern, 0, begin);
+            std::string suffix(pattern, end + 1);
+            commas.push_back(end);
+
+            std::string::size_type alternativeBegin = begin + 1;
+            for (std::vector<std::string::size_type>::const_iterator i =
+                commas.begin(); i < commas.end(); ++i)
+            {
+                std::string alternative = prefix + pattern.substr(
+                    alternativeBegin, *i - alternativeBegin) + suffix;
+
+                QuotedMask alternativeQuoted;
+                if (! quoted.empty()) {
+                    alternativeQuoted = subMask(quoted, 0, begin);
+                    alternativeQuoted.resize(begin);
+                    QuotedMask middle = subMask(quoted, alternativeBegin, *i);
+                    middle.resize(*i - alternativeBegin);
+                    QuotedMask last = subMask(quoted, end + 1, pattern.size());
+                    last.resize(pattern.size() - end - 1);
+                    alternativeQuoted.insert(alternativeQuoted.end(),
+                        middle.begin(), middle.end());
+                    alternativeQuoted.insert(alternativeQuoted.end(),
+                        last.begin(), last.end());
+                }
+
+                if (! expandBraces(alternative, alternativeQuoted,
+                    isEscapeEnabled, alternatives))
+                {
+                    alternatives.push_back(std::make_pair(alternative,
+                        alternativeQuoted));
+                }
+                alternativeBegin = *i + 1;
+            }
+            return true;
+        }
+
+        //
+        // Replace the leading '~' or '~user' by the home directory. It
+        // returns false if the user is unknown.
+        //
+
+        bool expandTilde(const std::string& pattern, std::string& expanded)
+        {
+            std::string::size_type slash = pattern.find('/');
+            std::string userName = pattern.substr(1,
+                (slash == std::string::npos) ? slash : slash - 1);
+            std::string rest = (slash == std::string::npos) ? std::string() :
+                pattern.substr(slash);
+
+            std::string home;
+            const char* homeVariable = std::getenv("HOME");
+            if (userName.empty() && homeVariable != NULL) {
+                home = homeVariable;
+            }
+            else {
+                struct passwd entry;
+                struct passwd* result = NULL;
+                std::vector<char> buffer(16 * 1024);
+                if (userName.empty()) {
+                    ::getpwuid_r(::getuid(), &entry, buffer.data(),
+                        buffer.size(), &result);
+                }
+                else {
+                    ::getpwnam_r(userName.c_str(), &entry, buffer.data(),
+                        buffer.size(), &result);
+                }
+                if (result == NULL) {
+                    return false;
+                }
+                home = result->pw_dir;
+            }
+
+            expanded = home + rest;
+            return true;
+        }
+
+        bool isDirectory(int dirFd, const char* name, unsigned char type)
+        {
+            if (type == DT_DIR) {
+                return true;
+            }
+            else if (type != DT_LNK && type != DT_UNKNOWN) {
+                return false;
+            }
+
+            struct stat status;
+            return ::fstatat(dirFd, name, &status, 0) == 0 &&
+                S_ISDIR(status.st_mode);
+        }
+    }
+
+    //
+    // Class CompiledPattern
+    //
+    // Pattern split into the components which are matched against the
+    // names of every directory walked. The slashes at the beginning of the
+    // pattern are kept apart as the root. Every component keeps the part of
+    // the mask of quoted characters which covers it.
+    //
+
+    class CompiledPattern
+    {
+        public:
+            struct Component
+            {
+                std::string pattern;
+                QuotedMask quoted;
+                ComponentMatcher matcher;   // If magic
+                std::string literal;        // Unescaped, if not magic
+                std::string separator;      // Slashes after the component
+                bool isMagic;
+                bool isEscaped;             // Escaped or quoted characters
+                bool isRecursive;           // '**'
+            };
+
+            CompiledPattern(const std::string& pattern,
+                const QuotedMask& quoted, bool isEscapeEnabled,
+                bool isRecursionEnabled);
+
+            const std::string& root() const
+                { return root_; }
+            const std::vector<Component>& components() const
+                { return components_; }
+            bool isMagic() const
+                { return isMagic_; }
+
+        private:
+            std::string root_;
+            std::vector<Component> components_;
+            bool isMagic_;
+    };
+
+    CompiledPattern::CompiledPattern(const std::string& pattern,
+        const QuotedMask& quoted, bool isEscapeEnabled,
+        bool isRecursionEnabled)
+        : isMagic_(false)
+    {
+        std::string::size_type begin = pattern.find_first_not_of('/');
+        root_.assign(pattern, 0, std::min(begin, pattern.size()));
+
+        while (begin < pattern.size()) {
+            std::string::size_type end = pattern.find('/', begin);
+            std::string::size_type next = pattern.find_first_not_of('/', end);
+            if (end == std::string::npos) {
+                end = next = pattern.size();
+            }
+            else if (next == std::string::npos) {
+                next = pattern.size();
+            }
+
+            components_.push_back(Component());
+            Component& component = components_.back();
+            component.pattern.assign(pattern, begin, end - begin);
+            component.quoted = subMask(quoted, begin, end);
+            if (std::find(component.quoted.begin(), component.quoted.end(),
+                true) == component.quoted.end())
+            {
+                component.quoted.clear();
+            }
+            component.separator.assign(pattern, end, next - end);
+            component.isMagic = glob::isMagic(component.pattern,
+                component.quoted, isEscapeEnabled);
+            component.isRecursive = isRecursionEnabled &&
+                component.pattern == "**" && component.quoted.empty();
+            if (component.isMagic) {
+                component.matcher = ComponentMatcher(component.pattern,
+                    component.quoted, isEscapeEnabled);
+                isMagic_ = true;
+            }
+            else {
+                component.literal = unescape(component.pattern,
+                    component.quoted, isEscapeEnabled);
+            }
+            component.isEscaped = ! component.quoted.empty() ||
+                (! component.isMagic &&
+                component.literal.size() != component.pattern.size());
+            begin = next;
+        }
+    }
+
+    //
+    // Class PatternCache
+    //
+    // LRU cache of compiled patterns shared by every Glob object, so the
+    // patterns expanded again and again are only compiled once.
+    //
+
+    class PatternCache
+    {
+        public:
+            static const std::size_t DEFAULT_CAPACITY = 256;
+
+            PatternCache(std::size_t capacity = DEFAULT_CAPACITY)
+                : capacity_(capacity)
+            {}
+
+            std::shared_ptr<const CompiledPattern> compile(
+                const std::string& pattern, const QuotedMask& quoted,
+                bool isEscapeEnabled, bool isRecursionEnabled);
+
+        private:
+            typedef std::list<std::pair<std::string,
+                std::shared_ptr<const CompiledPattern> > > EntriesType;
+
+            std::mutex mutex_;
+            EntriesType entries_;   // Most recently used first
+            std::unordered_map<std::string, EntriesType::iterator> index_;
+            std::size_t capacity_;
+    };
+
+    std::shared_ptr<const CompiledPattern> PatternCache::compile(
+        const std::string& pattern, const QuotedMask& quoted,
+        bool isEscapeEnabled, bool isRecursionEnabled)
+    {
+        std::string key(1, isEscapeEnabled ? 'e' : 'n');
+        key += isRecursionEnabled ? 'r' : 'n';
+        key += pattern;
+        if (! quoted.empty()) {
+            key.push_back('\0');
+            for (QuotedMask::const_iterator i = quoted.begin();
+                i < quoted.end(); ++i)
+            {
+                key.push_back(*i ? 'q' : '-');
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            std::unordered_map<std::string, EntriesType::iterator>::iterator
+                i = index_.find(key);
+            if (i != index_.end()) {
+                entries_.splice(entries_.begin(), entries_, i->second);
+                return i->second->second;
+            }
+        }
+
+        std::shared_ptr<const CompiledPattern> compiled =
+            std::make_shared<CompiledPattern>(pattern, quoted, isEscapeEnabled,
+                isRecursionEnabled);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if (index_.find(key) == index_.end()) {
+            while (entries_.size() >= capacity_) {
+                index_.erase(entries_.back().first);
+                entries_.pop_back();
+            }
+            entries_.push_front(std::make_pair(key, compiled));
+            index_[key] = entries_.begin();
+        }
+        return compiled;
+    }
+
+    namespace
+    {
+        PatternCache patternCache;
+    }
+
+    //
+    // Class DirectoryCache
+    //
+
+    namespace
+    {
+        const std::uint32_t DIRECTORY_WATCH_EVENTS = IN_CREATE | IN_DELETE |
+            IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF |
+            IN_ONLYDIR;
+
+        bool operator!=(const struct timespec& a, const struct timespec& b)
+        {
+            return a.tv_sec != b.tv_sec || a.tv_nsec != b.tv_nsec;
+        }
+    }
+
+    DirectoryCache::DirectoryCache(std::size_t budget)
+        : inotifyFd_(-1),
+          isInotifyStarted_(false),
+          budget_(budget),
+          size_(0),
+          hits_(0),
+          misses_(0)
+    {}
+
+    DirectoryCache::~DirectoryCache()
+    {
+        if (inotifyFd_ != -1) {
+            ::close(inotifyFd_);
+        }
+    }
+
+    void DirectoryCache::clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        shrink(0);
+    }
+
+    void DirectoryCache::budget(std::size_t budget)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        budget_ = budget;
+        shrink(budget_);
+    }
+
+    std::size_t DirectoryCache::budget() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return budget_;
+    }
+
+    std::size_t DirectoryCache::size() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return size_;
+    }
+
+    unsigned long long DirectoryCache::hits() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return hits_;
+    }
+
+    unsigned long long DirectoryCache::misses() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return misses_;
+    }
+
+    //
+    // Discard the directories changed since the last update, according to
+    // the inotify events queued
+    //
+
+    void DirectoryCache::update()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (inotifyFd_ == -1) {
+            return;
+        }
+
+        alignas(struct inotify_event) char buffer[4096];
+        while (true) {
+            ssize_t count = ::read(inotifyFd_, buffer, sizeof(buffer));
+            if (count == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return;     // EAGAIN if there are no more events
+            }
+
+            for (ssize_t offset = 0; offset < count;) {
+                const struct inotify_event* event =
+                    reinterpret_cast<const struct inotify_event*>(
+                        buffer + offset);
+                offset += sizeof(struct inotify_event) + event->len;
+
+                if (event->mask & IN_Q_OVERFLOW) {
+                    shrink(0);
+                    continue;
+                }
+
+                // The same directory can be watched through several paths
+                std::vector<DirectoriesType::iterator> changed;
+                std::pair<std::unordered_multimap<int, std::string>::
+                    const_iterator, std::unordered_multimap<int,
+                    std::string>::const_iterator> range =
+                        watches_.equal_range(event->wd);
+                for (std::unordered_multimap<int, std::string>::
+                    const_iterator i = range.first; i != range.second; ++i)
+                {
+                    changed.push_back(index_.at(i->second));
+                }
+                for (std::vector<DirectoriesType::iterator>::const_iterator
+                    i = changed.begin(); i < changed.end(); ++i)
+                {
+                    erase(*i);
+                }
+            }
+        }
+    }
+
+    std::shared_ptr<const DirectoryCache::EntriesType>
+    DirectoryCache::lookup(const std::string& path)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        std::unordered_map<std::string, DirectoriesType::iterator>::iterator
+            i = index_.find(path);
+        if (i == index_.end()) {
+            ++misses_;
+            return std::shared_ptr<const EntriesType>();
+        }
+
+        const Directory& directory = *i->second;
+        if (directory.watch == -1) {
+            struct stat status;
+            if (::stat(path.c_str(), &status) == -1 ||
+                status.st_dev != directory.device ||
+                status.st_ino != directory.inode ||
+                status.st_mtim != directory.modificationTime)
+            {
+                erase(i->second);
+                ++misses_;
+                return std::shared_ptr<const EntriesType>();
+            }
+        }
+
+        ++hits_;
+        directories_.splice(directories_.begin(), directories_, i->second);
+        return directory.entries;
+    }
+
+    std::shared_ptr<const DirectoryCache::EntriesType>
+    DirectoryCache::read(const std::string& path, std::vector<char>& buffer,
+        int& errorNumber)
+    {
+        // The directory is watched before reading it, so no change is lost
+        int watch = -1;
+        int inotifyFd = startInotify();
+        if (inotifyFd != -1) {
+            watch = ::inotify_add_watch(inotifyFd, path.c_str(),
+                DIRECTORY_WATCH_EVENTS);
+        }
+
+        std::shared_ptr<EntriesType> entries =
+            std::make_shared<EntriesType>();
+        struct stat status;
+        bool isRead = false;
+
+        int fd = ::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd != -1 && ::fstat(fd, &status) == 0) {
+            while (true) {
+                long count = ::syscall(SYS_getdents64, fd, buffer.data(),
+                    buffer.size());
+                if (count == 0) {
+                    isRead = true;
+                    break;
+                }
+                else if (count == -1) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    break;
+                }
+
+                for (long offset = 0; offset < count;) {
+                    const LinuxDirent64* entry =
+                        reinterpret_cast<const LinuxDirent64*>(
+                            buffer.data() + offset);
+                    offset += entry->d_reclen;
+                    entries->push_back(std::make_pair(
+                        std::string(entry->d_name), entry->d_type));
+                }
+            }
+        }
+        errorNumber = errno;
+        if (fd != -1) {
+            ::close(fd);
+        }
+
+        // Without inotify, changes made in the same second that the
+        // directory was read could not be detected by its modification time
+        bool isCacheable = isRead && (watch != -1 ||
+            status.st_mtim.tv_sec + 1 < std::time(NULL));
+
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        std::size_t size = sizeof(Directory) + path.size();
+        for (EntriesType::const_iterator i = entries->begin();
+            i < entries->end(); ++i)
+        {
+            size += sizeof(*i) + i->first.size();
+        }
+
+        if (isCacheable && size <= budget_) {
+            std::unordered_map<std::string, DirectoriesType::iterator>::
+                iterator i = index_.find(path);
+            if (i != index_.end()) {
+                erase(i->second);
+            }
+            shrink(budget_ - size);
+
+            Directory directory;
+            directory.path = path;
+            directory.entries = entries;
+            directory.size = size;
+            directory.watch = watch;
+            directory.device = status.st_dev;
+            directory.inode = status.st_ino;
+            directory.modificationTime = status.st_mtim;
+            directories_.push_front(directory);
+            index_[path] = directories_.begin();
+            if (watch != -1) {
+                watches_.insert(std::make_pair(watch, path));
+            }
+            size_ += size;
+        }
+        else if (watch != -1 && watches_.count(watch) == 0) {
+            ::inotify_rm_watch(inotifyFd_, watch);
+        }
+
+        if (! isRead) {
+            return std::shared_ptr<const EntriesType>();
+        }
+        return entries;
+    }
+
+    int DirectoryCache::startInotify()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (! isInotifyStarted_) {
+            inotifyFd_ = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+            isInotifyStarted_ = true;
+        }
+        return inotifyFd_;
+    }
+
+    void DirectoryCache::erase(DirectoriesType::iterator directory)
+    {
+        if (directory->watch != -1) {
+            std::pair<std::unordered_multimap<int, std::string>::iterator,
+                std::unordered_multimap<int, std::string>::iterator> range =
+                    watches_.equal_range(directory->watch);
+            for (std::unordered_multimap<int, std::string>::iterator i =
+                range.first; i != range.second; ++i)
+            {
+                if (i->second == directory->path) {
+                    watches_.erase(i);
+                    break;
+                }
+            }
+            if (watches_.count(directory->watch) == 0) {
+                ::inotify_rm_watch(inotifyFd_, directory->watch);
+            }
+        }
+
+        size_ -= directory->size;
+        index_.erase(directory->path);
+        directories_.erase(directory);
+    }
+
+    void DirectoryCache::shrink(std::size_t budget)
+    {
+        while (size_ > budget) {
+            erase(--directories_.end());
+        }
+    }
+
+    //
+    // Class GlobProducer
+    //
+    // Thread which walks the directories for a GlobStream and the ring
+    // where it puts the path names and errors found. The threads of '**'
+    // share the ring, so they push one at a time. The end of the walk is
+    // always pushed, after the exception thrown by the walk, if any, is
+    // kept to be rethrown by the stream.
+    //
+
+    class GlobProducer
+    {
+        public:
+            static const std::size_t RING_SIZE = 256;
+
+            struct Item
+            {
+                enum TypeOfItem
+                {
+                    PATH_NAME,
+                    ERROR,
+                    END
+                };
+
+                TypeOfItem type;
+                std::string pathName;
+                std::error_code errorCode;
+            };
+
+            GlobProducer()
+                : ring(RING_SIZE)
+            {}
+
+            cli::script::PrefetchRing<Item> ring;
+            std::thread thread;
+            std::exception_ptr exception;
+
+            //
+            // Push an item. It returns false if the stream was closed.
+            //
+
+            bool push(Item::TypeOfItem type, const std::string& pathName,
+                const char* suffix = "",
+                std::error_code errorCode = std::error_code());
+
+        private:
+            std::mutex mutex_;
+    };
+
+    bool GlobProducer::push(Item::TypeOfItem type,
+        const std::string& pathName, const char* suffix,
+        std::error_code errorCode)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        // The memory of the path names of the slots is reused
+        Item* item = ring.pushSlot();
+        if (item == NULL) {
+            return false;
+        }
+        item->type = type;
+        item->pathName.assign(pathName);
+        item->pathName += suffix;
+        item->errorCode = errorCode;
+        ring.push();
+        return true;
+    }
+
+    class RecursiveWalk;
+
+    //
+    // Class GlobWalker
+    //
+    // Walks the directories with openat() and getdents64(), only reading
+    // those which have to be matched against a pattern, and writes the path
+    // names found into the Glob object or, for a GlobStream, into the ring
+    // of its producer. The type of the entries returned by getdents64() is
+    // used to avoid calling stat() for most of them.
+    //
+    // The directories matched by '**' are walked by RecursiveWalk, with a
+    // GlobWalker for every thread which writes the path names found into
+    // its own pool.
+    //
+
+    class GlobWalker
+    {
+        public:
+            GlobWalker(Glob& glob, GlobFlags flags,
+                const GlobOptions& options)
+                : glob_(&glob),
+                  flags_(static_cast<int>(flags)),
+                  options_(options),
+                  isAborted_(false),
+                  pathNames_(&glob.pathNames_),
+                  pathNamesFound_(0),
+                  producer_(NULL),
+                  recursiveWalk_(NULL),
+                  budget_(options.budget != NULL ? options.budget :
+                      &ownBudget_),
+                  directoryCache_(options.directoryCache)
+            {}
+
+            // The path names are not sorted for a stream
+            GlobWalker(GlobProducer& producer, GlobFlags flags,
+                const GlobOptions& options)
+                : glob_(NULL),
+                  flags_(static_cast<int>(flags) | GLOB_NOSORT),
+                  options_(options),
+                  isAborted_(false),
+                  pathNames_(&results_),
+                  pathNamesFound_(0),
+                  producer_(&producer),
+                  recursiveWalk_(NULL),
+                  budget_(options.budget != NULL ? options.budget :
+                      &ownBudget_),
+                  directoryCache_(options.directoryCache)
+            {}
+
+            GlobWalker(const GlobWalker& owner, RecursiveWalk& recursiveWalk)
+                : glob_(owner.glob_),
+                  flags_(owner.flags_),
+                  options_(owner.options_),
+                  isAborted_(false),
+                  pattern_(owner.pattern_),
+                  pathNames_(&results_),
+                  pathNamesFound_(0),
+                  producer_(owner.producer_),
+                  recursiveWalk_(&recursiveWalk),
+                  budget_(owner.budget_),
+                  directoryCache_(owner.directoryCache_),
+                  currentDirectory_(owner.currentDirectory_)
+            {}
+
+            void glob(const std::string& pattern, const QuotedMask& quoted);
+
+        private:
+            friend class RecursiveWalk;
+
+            typedef CompiledPattern::Component Component;
+            typedef DirectoryCache::EntriesType EntriesType;
+
+            Glob* glob_;            // NULL for a stream
+            int flags_;
+            GlobOptions options_;
+            bool isAborted_;
+
+            std::shared_ptr<const CompiledPattern> pattern_;
+            std::vector<char> buffer_;
+
+            StringPool* pathNames_;
+            StringPool results_;
+            std::size_t pathNamesFound_;
+            GlobProducer* producer_;
+            RecursiveWalk* recursiveWalk_;
+
+            // Shared by the threads of '**'
+            GlobBudget ownBudget_;
+            GlobBudget* budget_;
+
+            DirectoryCache* directoryCache_;
+            std::string currentDirectory_;
+
+            bool hasFlag(int flag) const
+                { return (flags_ & flag) != 0; }
+            const std::vector<Component>& components() const
+                { return pattern_->components(); }
+            bool isAborted() const;
+            bool isAfterMagic(std::size_t index) const;
+            void addPathName(const std::string& path,
+                const char* suffix = "");
+
+            void globPattern(const std::string& pattern,
+                const QuotedMask& quoted);
+            void walk(int dirFd, std::string& path, std::size_t index);
+            void walkLiteral(int dirFd, std::string& path,
+                std::size_t index);
+            void walkMagic(int dirFd, std::string& path, std::size_t index);
+            void walkNames(int dirFd, std::string& path, std::size_t index,
+                const EntriesType& names);
+            void walkRecursive(int dirFd, std::string& path,
+                std::size_t index);
+
+            bool isMatch(const std::string& path, std::size_t index,
+                const char* name) const;
+            template <typename Function>
+            bool readDirectory(int dirFd, const std::string& path,
+                Function function);
+            bool readDirectory(int dirFd, const std::string& path,
+                std::size_t index, EntriesType& names);
+            std::shared_ptr<const EntriesType> readCachedDirectory(
+                const std::string& path, std::size_t index);
+            bool isWithinBudget(const std::string& path,
+                std::size_t entries);
+
+            void reportError(const std::string& path, int errorNumber);
+            void reportError(const std::string& path,
+                std::error_code errorCode);
+    };
+
+    //
+    // Class ThreadPool
+    //
+    // Threads which run the workers of the recursive walks, so they are
+    // not created again for every '**'. The idle threads wait on a
+    // condition variable. A new thread is created when there are more
+    // tasks than idle threads, so the tasks of a walk start at once.
+    //
+
+    class ThreadPool
+    {
+        public:
+            typedef std::function<void(std::size_t)> TaskType;
+
+            //
+            // Tasks which are waited for together
+            //
+
+            class TaskGroup
+            {
+                public:
+                    TaskGroup()
+                        : pending_(0)
+                    {}
+
+                private:
+                    friend class ThreadPool;
+
+                    std::size_t pending_;
+                    std::condition_variable finished_;
+                    std::exception_ptr exception_;
+            };
+
+            ThreadPool()
+                : idleThreads_(0)
+            {}
+
+            ThreadPool(const ThreadPool&) = delete;
+            ThreadPool& operator=(const ThreadPool&) = delete;
+
+            //
+            // Run task(0) to task(count - 1) in the threads of the pool. The
+            // task must live until wait() returns.
+            //
+
+            void run(TaskGroup& group, std::size_t count,
+                const TaskType& task);
+
+            //
+            // Wait for the tasks of the group, running those which were not
+            // started yet in this thread, and rethrow the first exception
+            // thrown by them, if any
+            //
+
+            void wait(TaskGroup& group);
+
+        private:
+            struct Task
+            {
+                const TaskType* function;
+                std::size_t index;
+                TaskGroup* group;
+            };
+
+            std::mutex mutex_;
+            std::condition_variable condition_;
+            std::deque<Task> tasks_;
+            std::size_t idleThreads_;
+
+            void runThread();
+            void finish(const Task& task, std::exception_ptr exception);
+    };
+
+    void ThreadPool::run(TaskGroup& group, std::size_t count,
+        const TaskType& task)
+    {
+        if (count == 0) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (std::size_t i = 0; i < count; ++i) {
+            Task newTask = { &task, i, &group };
+            tasks_.push_back(newTask);
+            ++group.pending_;
+        }
+
+        // If no thread can be created, wait() runs the tasks
+        try {
+            while (idleThreads_ < tasks_.size()) {
+                std::thread(&ThreadPool::runThread, this).detach();
+                ++idleThreads_;
+            }
+        }
+        catch (const std::system_error&) {}
+        condition_.notify_all();
+    }
+
+    void ThreadPool::wait(TaskGroup& group)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        std::deque<Task>::iterator i = tasks_.begin();
+        while (i != tasks_.end()) {
+            if (i->group != &group) {
+                ++i;
+                continue;
+            }
+
+            Task task = *i;
+            tasks_.erase(i);
+            lock.unlock();
+            std::exception_ptr exception;
+            try {
+                (*task.function)(task.index);
+            }
+            catch (...) {
+                exception = std::current_exception();
+            }
+            lock.lock();
+            finish(task, exception);
+            i = tasks_.begin();
+        }
+
+        while (group.pending_ > 0) {
+            group.finished_.wait(lock);
+        }
+        std::exception_ptr exception = group.exception_;
+        lock.unlock();
+        if (exception) {
+            std::rethrow_exception(exception);
+        }
+    }
+
+    void ThreadPool::runThread()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            while (tasks_.empty()) {
+                condition_.wait(lock);
+            }
+            Task task = tasks_.front();
+            tasks_.pop_front();
+            --idleThreads_;
+
+            lock.unlock();
+            std::exception_ptr exception;
+            try {
+                (*task.function)(task.index);
+            }
+            catch (...) {
+                exception = std::current_exception();
+            }
+            lock.lock();
+
+            ++idleThreads_;
+            finish(task, exception);
+        }
+    }
+
+    // Invoked with the mutex locked
+    void ThreadPool::finish(const Task& task, std::exception_ptr exception)
+    {
+        TaskGroup& group = *task.group;
+        if (exception && ! group.exception_) {
+            group.exception_ = exception;
+        }
+        if (--group.pending_ == 0) {
+            group.finished_.notify_all();
+        }
+    }
+
+    namespace
+    {
+        // Never destroyed, so its threads can still use it at exit
+        ThreadPool& recursionPool()
+        {
+            static ThreadPool* pool = new ThreadPool;
+            return *pool;
+        }
+    }
+
+    //
+    // Class RecursiveWalk
+    //
+    // Every thread takes the directories to walk from the back of its own
+    // queue, where it also puts the subdirectories found, so the walk is
+    // depth-first. When its queue is empty, it steals the oldest directory
+    // of the queue of another thread, and if there are none, it waits on a
+    // condition variable until some directory is queued or the walk ends.
+    // The thread which started the walk is the first worker and the others
+    // are run by the threads of the recursion pool. The errors are
+    // reported from the thread which started the walk, as it was done
+    // without threads.
+    //
+
+    class RecursiveWalk
+    {
+        public:
+            RecursiveWalk(GlobWalker& owner, std::size_t index);
+
+            void walk(int dirFd, const std::string& path);
+
+            bool isAborted() const
+                { return isAborted_; }
+            void reportError(const std::string& path,
+                std::error_code errorCode);
+
+        private:
+            typedef std::vector<std::pair<std::string, unsigned char> >
+                EntriesType;
+
+            struct Directory
+            {
+                std::string path;
+                std::size_t depth;
+                int fd;             // -1 if it is not open yet
+            };
+
+            struct Worker
+            {
+                std::mutex mutex;
+                std::deque<Directory> directories;
+                std::unique_ptr<GlobWalker> walker;
+            };
+
+            GlobWalker& owner_;
+            std::size_t index_;
+            dev_t device_;
+
+            std::vector<std::unique_ptr<Worker> > workers_;
+            std::atomic<std::size_t> pendingDirectories_;   // Or walked
+            std::atomic<std::size_t> queuedDirectories_;
+            std::atomic<bool> isAborted_;
+
+            // Workers waiting for directories. The counters and flags are
+            // sequentially consistent, so either a waiting worker sees the
+            // change or the thread which makes it sees the worker waiting.
+            std::atomic<unsigned> idleWorkers_;
+            std::mutex idleMutex_;
+            std::condition_variable idleCondition_;
+
+            std::mutex errorsMutex_;
+            std::vector<std::pair<std::string, std::error_code> > errors_;
+            std::atomic<bool> hasErrors_;
+
+            void push(Worker& worker, const Directory& directory);
+            bool pop(std::size_t worker, Directory& directory);
+            void run(std::size_t worker);
+            void waitForDirectories(std::size_t worker);
+            void wakeIdleWorkers();
+            void abort();
+            void walkDirectory(std::size_t worker,
+                const Directory& directory);
+            void reportErrors();
+    };
+
+    void GlobWalker::glob(const std::string& pattern,
+        const QuotedMask& quoted)
+    {
+        std::size_t first = pathNamesFound_;
+
+        if (directoryCache_ != NULL) {
+            char buffer[PATH_MAX];
+            if (::getcwd(buffer, sizeof(buffer)) == NULL) {
+                directoryCache_ = NULL;
+            }
+            else {
+                currentDirectory_ = buffer;
+                directoryCache_->update();
+            }
+        }
+
+        std::vector<std::pair<std::string, QuotedMask> > alternatives;
+        if (hasFlag(BRACE_FLAG) && expandBraces(pattern, quoted,
+            ! hasFlag(GLOB_NOESCAPE), alternatives))
+        {
+            // Every alternative is sorted apart, as the GNU glob() does
+            int flags = flags_;
+            flags_ &= ~(GLOB_NOCHECK | NOMAGIC_FLAG);
+            for (std::vector<std::pair<std::string, QuotedMask> >::
+                const_iterator i = alternatives.begin();
+                i < alternatives.end() && ! isAborted_; ++i)
+            {
+                globPattern(i->first, i->second);
+            }
+            flags_ = flags;
+
+            if (pathNamesFound_ == first && hasFlag(GLOB_NOCHECK) &&
+                ! isAborted())
+            {
+                addPathName(pattern);
+            }
+            return;
+        }
+
+        globPattern(pattern, quoted);
+    }
+
+    void GlobWalker::globPattern(const std::string& pattern,
+        const QuotedMask& quoted)
+    {
+        StringPool& pathNames = *pathNames_;
+        std::size_t first = pathNames.size();
+        std::size_t found = pathNamesFound_;
+
+        // The tilde prefix is not expanded if some character of it was
+        // quoted. The home directory is taken literally.
+        std::string::size_type slash = std::min(pattern.find('/'),
+            pattern.size());
+        bool isTildeQuoted = false;
+        for (std::string::size_type i = 0; i < slash; ++i) {
+            isTildeQuoted |= isQuoted(quoted, i);
+        }
+
+        std::string expanded = pattern;
+        QuotedMask expandedQuoted = quoted;
+        if (hasFlag(TILDE_FLAG | TILDE_CHECK_FLAG) && ! pattern.empty() &&
+            pattern[0] == '~' && ! isTildeQuoted)
+        {
+            if (expandTilde(pattern, expanded)) {
+                std::size_t homeSize = expanded.size() - pattern.size() +
+                    slash;
+                if (! quoted.empty() || expanded.find_first_of("*?[\\") <
+                    homeSize)
+                {
+                    expandedQuoted.assign(homeSize, true);
+                    QuotedMask rest = subMask(quoted, slash, pattern.size());
+                    rest.resize(pattern.size() - slash);
+                    expandedQuoted.insert(expandedQuoted.end(), rest.begin(),
+                        rest.end());
+                }
+            }
+            else if (hasFlag(TILDE_CHECK_FLAG)) {
+                return;
+            }
+        }
+
+        pattern_ = patternCache.compile(expanded, expandedQuoted,
+            ! hasFlag(GLOB_NOESCAPE), hasFlag(RECURSIVE_FLAG));
+        std::string root = pattern_->root();
+        bool isPatternMagic = pattern_->isMagic();
+
+        if (components().empty()) {
+            struct stat status;
+            if (! root.empty() && ::stat(root.c_str(), &status) == 0) {
+                addPathName(root);
+            }
+        }
+        else if (isPatternMagic && components()[0].isMagic &&
+            directoryCache_ == NULL)
+        {
+            int dirFd = ::open(root.empty() ? "." : root.c_str(),
+                O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (dirFd == -1) {
+                reportError(root.empty() ? "." : root, errno);
+            }
+            else {
+                walk(dirFd, root, 0);
+                ::close(dirFd);
+            }
+        }
+        else {
+            walk(AT_FDCWD, root, 0);
+        }
+
+        // As the GNU glob() does, escaped characters make the pattern
+        // magic for GLOB_NOMAGIC. So do the quoted ones.
+        if (pathNamesFound_ == found) {
+            bool isNoMagicChecked = hasFlag(NOMAGIC_FLAG) &&
+                ! isPatternMagic && ! pattern.empty() && quoted.empty() &&
+                (hasFlag(GLOB_NOESCAPE) ||
+                    pattern.find('\\') == std::string::npos);
+            if (! isAborted() && (hasFlag(GLOB_NOCHECK) || isNoMagicChecked))
+            {
+                addPathName(pattern);
+            }
+        }
+        else if (! hasFlag(GLOB_NOSORT) && producer_ == NULL) {
+            pathNames.sort(first, [](const char* a, const char* b)
+                {
+                    return std::strcoll(a, b) < 0;
+                });
+        }
+    }
+
+    bool GlobWalker::isAborted() const
+    {
+        return isAborted_ || budget_->isExceeded_ ||
+            (recursiveWalk_ != NULL && recursiveWalk_->isAborted()) ||
+            (producer_ != NULL && producer_->ring.isClosed());
+    }
+
+    void GlobWalker::addPathName(const std::string& path,
+        const char* suffix)
+    {
+        if (budget_->pathNames_.fetch_add(1) >= options_.maxPathNames) {
+            if (! budget_->isExceeded_.exchange(true)) {
+                reportError(path, GlobError::LIMIT_EXCEEDED);
+            }
+            return;
+        }
+
+        ++pathNamesFound_;
+        if (producer_ == NULL) {
+            pathNames_->push_back(*suffix == '\0' ? path : path + suffix);
+        }
+        else if (! producer_->push(GlobProducer::Item::PATH_NAME, path,
+            suffix))
+        {
+            isAborted_ = true;
+        }
+    }
+
+    bool GlobWalker::isAfterMagic(std::size_t index) const
+    {
+        for (std::size_t i = 0; i < index; ++i) {
+            if (components()[i].isMagic) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void GlobWalker::walk(int dirFd, std::string& path, std::size_t index)
+    {
+        if (isAborted()) {
+            return;
+        }
+        else if (components()[index].isRecursive) {
+            walkRecursive(dirFd, path, index);
+        }
+        else if (components()[index].isMagic) {
+            walkMagic(dirFd, path, index);
+        }
+        else {
+            walkLiteral(dirFd, path, index);
+        }
+    }
+
+    //
+    // Consecutive literal components are taken as a single relative path,
+    // so their directories are not read
+    //
+
+    void GlobWalker::walkLiteral(int dirFd, std::string& path,
+        std::size_t index)
+    {
+        std::string::size_type pathSize = path.size();
+
+        std::size_t next = index;
+        for (; next < components().size() && ! components()[next].isMagic;
+            ++next)
+        {
+            path += components()[next].literal;
+            path += components()[next].separator;
+        }
+
+        // The beginning of the path is that of the directory descriptor
+        const char* relativePath = (dirFd == AT_FDCWD) ? path.c_str() :
+            path.c_str() + pathSize;
+
+        if (next == components().size()) {
+            // As the GNU glob() does, GLOB_ONLYDIR is only honored if the
+            // last component had escaped characters
+            const Component& last = components().back();
+            bool isDirectoryRequired = hasFlag(ONLYDIR_FLAG) &&
+                last.isEscaped;
+
+            struct stat status;
+            if (::fstatat(dirFd, relativePath, &status,
+                AT_SYMLINK_NOFOLLOW) == 0 && (! isDirectoryRequired ||
+                    isDirectory(dirFd, relativePath, DT_UNKNOWN)))
+            {
+                bool isMarked = hasFlag(GLOB_MARK) && ! path.empty() &&
+                    path.back() != '/' &&
+                    isDirectory(dirFd, relativePath, DT_UNKNOWN);
+                addPathName(path, isMarked ? "/" : "");
+            }
+        }
+        else if (directoryCache_ != NULL) {
+            walk(AT_FDCWD, path, next);
+        }
+        else {
+            int fd = ::openat(dirFd, relativePath,
+                O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (fd == -1) {
+                // As the GNU glob() does, missing directories are ignored
+                // if they were expected because of a magic component
+                if (errno != ENOTDIR &&
+                    (errno != ENOENT || ! isAfterMagic(index)))
+                {
+                    std::string::size_type end =
+                        path.find_last_not_of('/');
+                    reportError(path.substr(0, end + 1), errno);
+                }
+            }
+            else {
+                walk(fd, path, next);
+                ::close(fd);
+            }
+        }
+
+        path.resize(pathSize);
+    }
+
+    void GlobWalker::walkMagic(int dirFd, std::string& path,
+        std::size_t index)
+    {
+        // The directory is read before walking the subdirectories, because
+        // the buffer is shared
+        EntriesType names;
+        if (readDirectory(dirFd, path, index, names)) {
+            walkNames(dirFd, path, index, names);
+        }
+    }
+
+    //
+    // Walk the entries of the directory which match the component
+    //
+
+    void GlobWalker::walkNames(int dirFd, std::string& path,
+        std::size_t index, const EntriesType& names)
+    {
+        const Component& component = components()[index];
+
+        std::string::size_type pathSize = path.size();
+        bool isLast = (index + 1 == components().size());
+        bool isDirectoryRequired = ! component.separator.empty() ||
+            hasFlag(ONLYDIR_FLAG);
+
+        for (EntriesType::const_iterator i = names.begin(); i < names.end();
+            ++i)
+        {
+            // The beginning of the path is that of the directory descriptor
+            path += i->first;
+            const char* name = (dirFd == AT_FDCWD) ? path.c_str() :
+                path.c_str() + pathSize;
+
+            if (isLast) {
+                bool isDir = false;
+                if (isDirectoryRequired || hasFlag(GLOB_MARK)) {
+                    isDir = isDirectory(dirFd, name, i->second);
+                }
+                if (! isDirectoryRequired || isDir) {
+                    bool isMarked = isDir && hasFlag(GLOB_MARK) &&
+                        component.separator.empty();
+                    addPathName(path, isMarked ? "/" :
+                        component.separator.c_str());
+                }
+            }
+            else if (i->second == DT_DIR || i->second == DT_LNK ||
+                i->second == DT_UNKNOWN)
+            {
+                if (directoryCache_ != NULL) {
+                    // The subdirectory is only open if it is not cached
+                    path += component.separator;
+                    walk(AT_FDCWD, path, index + 1);
+                }
+                else {
+                    int fd = ::openat(dirFd, name,
+                        O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                    if (fd == -1) {
+                        // Broken links and entries removed meanwhile are
+                        // ignored
+                        if (errno != ENOTDIR && errno != ENOENT) {
+                            reportError(path, errno);
+                        }
+                    }
+                    else {
+                        path += component.separator;
+                        walk(fd, path, index + 1);
+                        ::close(fd);
+                    }
+                }
+            }
+            path.resize(pathSize);
+
+            if (isAborted()) {
+                return;
+            }
+        }
+    }
+
+    //
+    // Only the walks started from the Glob object use several threads.
+    // Those started from a thread, because of another '**', use only that
+    // thread.
+    //
+
+    void GlobWalker::walkRecursive(int dirFd, std::string& path,
+        std::size_t index)
+    {
+        RecursiveWalk recursiveWalk(*this, index);
+        recursiveWalk.walk(dirFd, path);
+    }
+
+    bool GlobWalker::isMatch(const std::string& path, std::size_t index,
+        const char* name) const
+    {
+        const Component& component = components()[index];
+
+        // As the GNU glob() does, GLOB_PERIOD is ignored by the directory
+        // components, which includes a single one followed by slashes
+        bool isLast = (index + 1 == components().size());
+        bool isPeriodMatched = hasFlag(PERIOD_FLAG) && isLast &&
+            (! path.empty() || component.separator.empty());
+
+        return component.matcher.match(name, isPeriodMatched);
+    }
+
+    //
+    // Invoke 'function' with the name and the type of every entry of the
+    // directory
+    //
+
+    template <typename Function>
+    bool GlobWalker::readDirectory(int dirFd, const std::string& path,
+        Function function)
+    {
+        if (buffer_.empty()) {
+            buffer_.resize(DIRENTS_BUFFER_SIZE);
+        }
+
+        while (true) {
+            long count = ::syscall(SYS_getdents64, dirFd, buffer_.data(),
+                buffer_.size());
+            if (count == 0) {
+                return true;
+            }
+            else if (count == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                std::string::size_type end = path.find_last_not_of('/');
+                reportError(path.empty() ? std::string(".") :
+                    path.substr(0, end + 1), errno);
+                return false;
+            }
+
+            std::size_t entries = 0;
+            for (long offset = 0; offset < count; ++entries) {
+                const LinuxDirent64* entry =
+                    reinterpret_cast<const LinuxDirent64*>(
+                        buffer_.data() + offset);
+                offset += entry->d_reclen;
+                function(entry->d_name, entry->d_type);
+            }
+            if (! isWithinBudget(path, entries)) {
+                return false;
+            }
+        }
+    }
+
+    bool GlobWalker::readDirectory(int dirFd, const std::string& path,
+        std::size_t index, EntriesType& names)
+    {
+        if (directoryCache_ != NULL) {
+            std::shared_ptr<const EntriesType> entries =
+                readCachedDirectory(path, index);
+            if (! entries) {
+                return false;
+            }
+            for (EntriesType::const_iterator i = entries->begin();
+                i < entries->end(); ++i)
+            {
+                if (isMatch(path, index, i->first.c_str())) {
+                    names.push_back(*i);
+                }
+            }
+            return true;
+        }
+
+        return readDirectory(dirFd, path,
+            [&](const char* name, unsigned char type)
+            {
+                if (isMatch(path, index, name)) {
+                    names.push_back(std::make_pair(std::string(name), type));
+                }
+            });
+    }
+
+    //
+    // The directories are not open while walking if the cache is used, so
+    // the errors are reported here as they would have been when opening
+    // them
+    //
+
+    std::shared_ptr<const DirectoryCache::EntriesType>
+    GlobWalker::readCachedDirectory(const std::string& path,
+        std::size_t index)
+    {
+        std::string absolutePath;
+        if (path.empty() || path[0] != '/') {
+            absolutePath = currentDirectory_;
+            absolutePath += '/';
+        }
+        absolutePath += path;
+
+        std::shared_ptr<const EntriesType> entries =
+            directoryCache_->lookup(absolutePath);
+        if (entries) {
+            return isWithinBudget(path, entries->size()) ? entries :
+                std::shared_ptr<const EntriesType>();
+        }
+
+        if (buffer_.empty()) {
+            buffer_.resize(DIRENTS_BUFFER_SIZE);
+        }
+
+        int errorNumber = 0;
+        entries = directoryCache_->read(absolutePath, buffer_, errorNumber);
+        if (! entries) {
+            bool isIgnored = index > 0 && (errorNumber == ENOTDIR ||
+                (errorNumber == ENOENT && isAfterMagic(index)));
+            if (! isIgnored) {
+                std::string::size_type end = path.find_last_not_of('/');
+                if (end == std::string::npos) {
+                    reportError(path.empty() ? std::string(".") : path,
+                        errorNumber);
+                }
+                else {
+                    reportError(path.substr(0, end + 1), errorNumber);
+                }
+            }
+        }
+        else if (! isWithinBudget(path, entries->size())) {
+            entries.reset();
+        }
+        return entries;
+    }
+
+    //
+    // Charge the entries read from a directory to the budget. If it is
+    // exceeded, or the expansion was cancelled, the error is reported only
+    // once, by the first thread which notices it.
+    //
+
+    bool GlobWalker::isWithinBudget(const std::string& path,
+        std::size_t entries)
+    {
+        GlobError error;
+        if (options_.cancellationToken != NULL &&
+            options_.cancellationToken->isCancelled())
+        {
+            error = GlobError::CANCELLED;
+        }
+        else if (budget_->entriesVisited_.fetch_add(entries) + entries >
+            options_.maxEntriesVisited)
+        {
+            error = GlobError::LIMIT_EXCEEDED;
+        }
+        else if (options_.maxTime.count() > 0 &&
+            std::chrono::steady_clock::now() >
+            budget_->startTime_ + options_.maxTime)
+        {
+            error = GlobError::LIMIT_EXCEEDED;
+        }
+        else {
+            return true;
+        }
 
-#include <cli/glob.hpp>
+        if (! budget_->isExceeded_.exchange(true)) {
+            reportError(path.empty() ? std::string(".") : path, error);
+        }
+        return false;
+    }
 
-namespace glob
-{
-    namespace posix {
-        #include <glob.h>
+    void GlobWalker::reportError(const std::string& path, int errorNumber)
+    {
+        reportError(path, std::error_code(errorNumber,
+            std::system_category()));
+    }
+
+    void GlobWalker::reportError(const std::string& path,
+        std::error_code errorCode)
+    {
+        if (recursiveWalk_ != NULL) {
+            recursiveWalk_->reportError(path, errorCode);
+            return;
+        }
+
+        // The errors of the budget always stop the walk
+        bool isFatal = hasFlag(GLOB_ERR) ||
+            errorCode.category() == globCategory();
+
+        // The stream reports the error when it is reached
+        if (producer_ != NULL) {
+            if (! producer_->push(GlobProducer::Item::ERROR, path, "",
+                errorCode) || isFatal)
+            {
+                isAborted_ = true;
+            }
+            return;
+        }
+
+        glob_->errors_.push_back(std::make_pair(path, errorCode));
+        if (glob_->onError(path, errorCode) || isFatal) {
+            isAborted_ = true;
+        }
     }
 
     //
-    // POSIX function glob() will call onGlobError() on error. This uses
-    // the TSS variable currentGlobObject to remember the Glob object from
-    // which the glob() function was invoked.
+    // Class RecursiveWalk
     //
 
-    thread_local Glob* globObject;
+    RecursiveWalk::RecursiveWalk(GlobWalker& owner, std::size_t index)
+        : owner_(owner),
+          index_(index),
+          device_(0),
+          pendingDirectories_(0),
+          queuedDirectories_(0),
+          isAborted_(false),
+          idleWorkers_(0),
+          hasErrors_(false)
+    {
+        unsigned threads = 1;
+        if (owner.recursiveWalk_ == NULL) {
+            threads = owner.options_.recursionThreads;
+            if (threads == 0) {
+                threads = std::max(std::thread::hardware_concurrency(), 1u);
+            }
+        }
+
+        for (unsigned i = 0; i < threads; ++i) {
+            workers_.push_back(std::unique_ptr<Worker>(new Worker));
+            workers_.back()->walker.reset(new GlobWalker(owner, *this));
+        }
+    }
+
+    void RecursiveWalk::walk(int dirFd, const std::string& path)
+    {
+        if (! owner_.options_.isMountPointCrossed) {
+            struct stat status;
+            int result = (dirFd == AT_FDCWD) ?
+                ::stat(path.empty() ? "." : path.c_str(), &status) :
+                ::fstat(dirFd, &status);
+            if (result == -1) {
+                owner_.reportError(path.empty() ? "." : path, errno);
+                return;
+            }
+            device_ = status.st_dev;
+        }
+
+        Directory directory = { path, 0, (dirFd == AT_FDCWD) ? -1 : dirFd };
+        push(*workers_[0], directory);
+
+        // The thread of the owner is the first worker
+        ThreadPool::TaskType task = [this](std::size_t index)
+        {
+            try {
+                run(index + 1);
+            }
+            catch (...) {
+                abort();
+                throw;
+            }
+        };
+        ThreadPool::TaskGroup group;
+        recursionPool().run(group, workers_.size() - 1, task);
+        try {
+            run(0);
+        }
+        catch (...) {
+            abort();
+            try {
+                recursionPool().wait(group);
+            }
+            catch (...) {}
+            throw;
+        }
+        recursionPool().wait(group);
+        reportErrors();
+
+        for (std::vector<std::unique_ptr<Worker> >::const_iterator i =
+            workers_.begin(); i < workers_.end(); ++i)
+        {
+            owner_.pathNames_->append((*i)->walker->results_);
+            owner_.pathNamesFound_ += (*i)->walker->pathNamesFound_;
+        }
+    }
+
+    void RecursiveWalk::reportError(const std::string& path,
+        std::error_code errorCode)
+    {
+        {
+            std::lock_guard<std::mutex> lock(errorsMutex_);
+            errors_.push_back(std::make_pair(path, errorCode));
+            hasErrors_ = true;
+            if (owner_.hasFlag(GLOB_ERR) ||
+                errorCode.category() == globCategory())
+            {
+                isAborted_ = true;
+            }
+        }
+        wakeIdleWorkers();
+    }
+
+    void RecursiveWalk::push(Worker& worker, const Directory& directory)
+    {
+        ++pendingDirectories_;
+        {
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            worker.directories.push_back(directory);
+        }
+        ++queuedDirectories_;
+        wakeIdleWorkers();
+    }
+
+    bool RecursiveWalk::pop(std::size_t worker, Directory& directory)
+    {
+        {
+            Worker& own = *workers_[worker];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (! own.directories.empty()) {
+                directory = own.directories.back();
+                own.directories.pop_back();
+                --queuedDirectories_;
+                return true;
+            }
+        }
+
+        for (std::size_t i = 1; i < workers_.size(); ++i) {
+            Worker& victim = *workers_[(worker + i) % workers_.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (! victim.directories.empty()) {
+                directory = victim.directories.front();
+                victim.directories.pop_front();
+                --queuedDirectories_;
+                return true;
+            }
+        }
+        return false;
+    }
 
-    extern "C" int onGlobError(const char *epath, int eerrno)
+    void RecursiveWalk::run(std::size_t worker)
     {
-        std::string pathName(epath);
-        std::error_code errorCode(eerrno, std::system_category());
+        unsigned idleRounds = 0;
+        while (true) {
+            if (worker == 0) {
+                reportErrors();
+            }
+            if (isAborted_) {
+                return;
+            }
 
-        globObject->errors_.push_back(std::make_pair(pathName, errorCode));
-        return globObject->onError(pathName, errorCode);
+            Directory directory;
+            if (pop(worker, directory)) {
+                walkDirectory(worker, directory);
+                if (--pendingDirectories_ == 0) {
+                    wakeIdleWorkers();
+                }
+                idleRounds = 0;
+            }
+            else if (pendingDirectories_ == 0) {
+                return;
+            }
+            else if (++idleRounds < 64) {
+                std::this_thread::yield();
+            }
+            else {
+                waitForDirectories(worker);
+                idleRounds = 0;
+            }
+        }
     }
 
     //
-    // Class Glob
+    // Wait until some directory is queued, the walk ends or, for the first
+    // worker, there are errors to report
     //
 
-    Glob::Glob(const std::string& pattern, GlobFlags flags)
+    void RecursiveWalk::waitForDirectories(std::size_t worker)
+    {
+        std::unique_lock<std::mutex> lock(idleMutex_);
+        ++idleWorkers_;
+        while (! isAborted_ && pendingDirectories_ > 0 &&
+            queuedDirectories_ == 0 && ! (worker == 0 && hasErrors_))
+        {
+            idleCondition_.wait(lock);
+        }
+        --idleWorkers_;
+    }
+
+    void RecursiveWalk::wakeIdleWorkers()
+    {
+        if (idleWorkers_ > 0) {
+            std::lock_guard<std::mutex> lock(idleMutex_);
+            idleCondition_.notify_all();
+        }
+    }
+
+    void RecursiveWalk::abort()
+    {
+        isAborted_ = true;
+        wakeIdleWorkers();
+    }
+
+    void RecursiveWalk::walkDirectory(std::size_t worker,
+        const Directory& directory)
     {
-        globObject = this;
+        GlobWalker& walker = *workers_[worker]->walker;
+
+        int dirFd = directory.fd;
+        std::shared_ptr<const EntriesType> cachedEntries;
+        EntriesType names;
+        const EntriesType* entries = &names;
+
+        if (walker.directoryCache_ != NULL) {
+            dirFd = AT_FDCWD;
+            cachedEntries = walker.readCachedDirectory(directory.path,
+                index_);
+            if (! cachedEntries) {
+                return;
+            }
+            entries = cachedEntries.get();
+        }
+        else {
+            if (dirFd == -1) {
+                dirFd = ::open(directory.path.empty() ? "." :
+                    directory.path.c_str(),
+                    O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                if (dirFd == -1) {
+                    // Entries removed meanwhile are ignored
+                    if (errno != ENOENT && errno != ENOTDIR) {
+                        std::string::size_type end =
+                            directory.path.find_last_not_of('/');
+                        walker.reportError(directory.path.substr(0, end + 1),
+                            errno);
+                    }
+                    return;
+                }
+            }
+            walker.readDirectory(dirFd, directory.path,
+                [&](const char* name, unsigned char type)
+                {
+                    names.push_back(std::make_pair(std::string(name), type));
+                });
+        }
 
-        posix::glob_t glob;
-        posix::glob(pattern.c_str(), static_cast<int>(flags), &onGlobError,
-            &glob);
+        bool isFileSystemChecked = ! walker.options_.isMountPointCrossed;
+        bool isPeriodMatched = walker.hasFlag(PERIOD_FLAG);
+        bool isDeeper = directory.depth < walker.options_.maxRecursionDepth;
 
-        globObject = nullptr;
+        const CompiledPattern::Component& component =
+            walker.components()[index_];
+        bool isLast = (index_ + 1 == walker.components().size());
+        if (isLast && (directory.depth == 0 ||
+            ! component.separator.empty()) && ! directory.path.empty())
+        {
+            walker.addPathName(directory.path);
+        }
+
+        std::string path = directory.path;
+        std::string::size_type pathSize = path.size();
+        for (EntriesType::const_iterator i = entries->begin();
+            i < entries->end(); ++i)
+        {
+            const char* name = i->first.c_str();
+            if ((name[0] == '.' && ! isPeriodMatched) ||
+                i->first == "." || i->first == "..")
+            {
+                continue;
+            }
+
+            path += i->first;
+            const char* relativeName = (dirFd == AT_FDCWD) ? path.c_str() :
+                path.c_str() + pathSize;
+
+            // Symbolic links are not followed
+            bool isDir = (i->second == DT_DIR);
+            struct stat status;
+            if (i->second == DT_UNKNOWN || (isDir && isFileSystemChecked)) {
+                isDir = ::fstatat(dirFd, relativeName, &status,
+                    AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(status.st_mode);
+            }
+
+            if (isLast && component.separator.empty() &&
+                (isDir || ! walker.hasFlag(ONLYDIR_FLAG)))
+            {
+                walker.addPathName(path,
+                    (isDir && walker.hasFlag(GLOB_MARK)) ? "/" : "");
+            }
+
+            if (isDir && isDeeper &&
+                (! isFileSystemChecked || status.st_dev == device_))
+            {
+                Directory subdirectory = { path + '/', directory.depth + 1,
+                    -1 };
+                push(*workers_[worker], subdirectory);
+            }
+            path.resize(pathSize);
+        }
+
+        if (! isLast) {
+            // The entries already read are matched against the next
+            // component, if it is not a literal
+            std::size_t next = index_ + 1;
+            const CompiledPattern::Component& nextComponent =
+                walker.components()[next];
+            if (nextComponent.isMagic && ! nextComponent.isRecursive) {
+                EntriesType nextNames;
+                for (EntriesType::const_iterator i = entries->begin();
+                    i < entries->end(); ++i)
+                {
+                    if (walker.isMatch(path, next, i->first.c_str())) {
+                        nextNames.push_back(*i);
+                    }
+                }
+                walker.walkNames(dirFd, path, next, nextNames);
+            }
+            else {
+                walker.walk(dirFd, path, next);
+            }
+        }
+
+        if (dirFd != directory.fd && dirFd != AT_FDCWD) {
+            ::close(dirFd);
+        }
+    }
+
+    void RecursiveWalk::reportErrors()
+    {
+        std::vector<std::pair<std::string, std::error_code> > errors;
+        {
+            std::lock_guard<std::mutex> lock(errorsMutex_);
+            errors.swap(errors_);
+            hasErrors_ = false;
+        }
 
-        if (glob.gl_pathc) {
-            for (char** p = glob.gl_pathv; *p != NULL; ++p) {
-                pathNames_.push_back(*p);
+        // The error which aborted the walk has to be reported too
+        for (std::vector<std::pair<std::string, std::error_code> >::
+            const_iterator i = errors.begin();
+            i < errors.end() && ! owner_.isAborted_; ++i)
+        {
+            owner_.reportError(i->first, i->second);
+            if (owner_.isAborted_) {
+                abort();
             }
         }
+    }
+
+    //
+    // Category of GlobError
+    //
+
+    namespace
+    {
+        class GlobCategory : public std::error_category
+        {
+            public:
+                virtual const char* name() const noexcept
+                    { return "glob"; }
 
-        posix::globfree(&glob);
+                virtual std::string message(int condition) const
+                {
+                    switch (static_cast<GlobError>(condition)) {
+                    case GlobError::LIMIT_EXCEEDED:
+                        return "expansion limit exceeded";
+                    case GlobError::CANCELLED:
+                        return "expansion cancelled";
+                    }
+                    return "unknown error";
+                }
+        };
+    }
+
+    const std::error_category& globCategory()
+    {
+        static GlobCategory category;
+        return category;
+    }
+
+    //
+    // Class Glob
+    //
+
+    Glob::Glob(const std::string& pattern, GlobFlags flags,
+        const GlobOptions& options)
+    {
+        GlobWalker walker(*this, flags, options);
+        walker.glob(pattern, QuotedMask());
+    }
+
+    Glob::Glob(const std::string& pattern, const QuotedRanges& quoted,
+        GlobFlags flags, const GlobOptions& options)
+    {
+        GlobWalker walker(*this, flags, options);
+        walker.glob(pattern, makeQuotedMask(quoted, pattern.size()));
     }
 
     bool Glob::onError(const std::string& pathName,
@@ -102,4 +2722,416 @@ namespace glob
 
         return escaped;
     }
+
+    std::string Glob::unescape(const std::string& pattern)
+    {
+        return glob::unescape(pattern, QuotedMask(), true);
+    }
+
+    //
+    // Class BraceExpansion
+    //
+
+    namespace
+    {
+        const std::size_t MAX_SIZE = static_cast<std::size_t>(-1);
+
+        std::size_t saturatedAdd(std::size_t a, std::size_t b)
+        {
+            return (a > MAX_SIZE - b) ? MAX_SIZE : a + b;
+        }
+
+        std::size_t saturatedMultiply(std::size_t a, std::size_t b)
+        {
+            return (b != 0 && a > MAX_SIZE / b) ? MAX_SIZE : a * b;
+        }
+
+        bool parseInteger(const std::string& text, long long& value)
+        {
+            std::string::size_type digits = (! text.empty() &&
+                (text[0] == '-' || text[0] == '+')) ? 1 : 0;
+            if (digits == text.size() || text.find_first_not_of(
+                "0123456789", digits) != std::string::npos)
+            {
+                return false;
+            }
+
+            errno = 0;
+            value = std::strtoll(text.c_str(), NULL, 10);
+            return errno != ERANGE;
+        }
+
+        bool isZeroPadded(const std::string& text)
+        {
+            std::string::size_type digits = (text[0] == '-') ? 1 : 0;
+            return text.size() > digits + 1 && text[digits] == '0';
+        }
+    }
+
+    BraceExpansion::BraceExpansion(const std::string& pattern,
+        const QuotedRanges& quoted, std::size_t limit)
+        : pattern_(pattern),
+          quoted_(quoted)
+    {
+        root_ = parse(0, pattern_.size(),
+            makeQuotedMask(quoted_, pattern_.size()));
+        size_ = sequenceSizes_[root_];
+        if (size_ > limit) {
+            throw std::system_error(E2BIG, std::system_category(), pattern);
+        }
+    }
+
+    std::size_t BraceExpansion::parse(std::size_t begin, std::size_t end,
+        const std::vector<bool>& quoted)
+    {
+        SequenceType sequence;
+        std::size_t size = 1;
+        std::size_t textBegin = begin;
+        std::vector<std::size_t> commas;
+
+        for (std::size_t i = begin; i < end; ++i) {
+            if (isQuoted(quoted, i)) {
+                continue;
+            }
+            else if (pattern_[i] == '\\') {
+                ++i;
+                continue;
+            }
+            else if (pattern_[i] != '{') {
+                continue;
+            }
+
+            // Look for the closing brace at the same depth
+            std::size_t close = std::string::npos;
+            unsigned depth = 0;
+            commas.clear();
+            for (std::size_t j = i + 1; j < end; ++j) {
+                if (isQuoted(quoted, j)) {
+                    continue;
+                }
+                else if (pattern_[j] == '\\') {
+                    ++j;
+                }
+                else if (pattern_[j] == '{') {
+                    ++depth;
+                }
+                else if (pattern_[j] == '}') {
+                    if (depth == 0) {
+                        close = j;
+                        break;
+                    }
+                    --depth;
+                }
+                else if (pattern_[j] == ',' && depth == 0) {
+                    commas.push_back(j);
+                }
+            }
+            if (close == std::string::npos) {
+                continue;
+            }
+
+            Node node = Node();
+            if (commas.empty()) {
+                bool isRangeQuoted = false;
+                for (std::size_t j = i + 1; j < close; ++j) {
+                    isRangeQuoted |= isQuoted(quoted, j);
+                }
+                if (isRangeQuoted || ! parseRange(i + 1, close, node)) {
+                    continue;
+                }
+            }
+            else {
+                node.type = Node::LIST;
+                node.size = 0;
+                commas.push_back(close);
+
+                std::size_t alternativeBegin = i + 1;
+                for (std::vector<std::size_t>::const_iterator j =
+                    commas.begin(); j < commas.end(); ++j)
+                {
+                    std::size_t alternative = parse(alternativeBegin, *j,
+                        quoted);
+                    node.alternatives.push_back(alternative);
+                    node.size = saturatedAdd(node.size,
+                        sequenceSizes_[alternative]);
+                    alternativeBegin = *j + 1;
+                }
+            }
+
+            if (textBegin < i) {
+                Node text = Node();
+                text.type = Node::TEXT;
+                text.begin = textBegin;
+                text.end = i;
+                text.size = 1;
+                sequence.push_back(nodes_.size());
+                nodes_.push_back(text);
+            }
+            size = saturatedMultiply(size, node.size);
+            sequence.push_back(nodes_.size());
+            nodes_.push_back(node);
+            textBegin = close + 1;
+            i = close;
+        }
+
+        if (textBegin < end) {
+            Node text = Node();
+            text.type = Node::TEXT;
+            text.begin = textBegin;
+            text.end = end;
+            text.size = 1;
+            sequence.push_back(nodes_.size());
+            nodes_.push_back(text);
+        }
+
+        sequences_.push_back(sequence);
+        sequenceSizes_.push_back(size);
+        return sequences_.size() - 1;
+    }
+
+    bool BraceExpansion::parseRange(std::size_t begin, std::size_t end,
+        Node& node) const
+    {
+        std::string range(pattern_, begin, end - begin);
+        std::string::size_type dots = range.find("..");
+        if (dots == std::string::npos) {
+            return false;
+        }
+        std::string::size_type stepDots = range.find("..", dots + 2);
+
+        std::string first(range, 0, dots);
+        std::string last(range, dots + 2, (stepDots == std::string::npos) ?
+            std::string::npos : stepDots - dots - 2);
+        long long step = 1;
+        if (stepDots != std::string::npos &&
+            ! parseInteger(range.substr(stepDots + 2), step))
+        {
+            return false;
+        }
+
+        long long firstValue;
+        long long lastValue;
+        if (parseInteger(first, firstValue) &&
+            parseInteger(last, lastValue))
+        {
+            node.isAlphabetic = false;
+            if (isZeroPadded(first) || isZeroPadded(last)) {
+                node.width = static_cast<int>(std::max(first.size(),
+                    last.size()));
+            }
+        }
+        else if (first.size() == 1 && last.size() == 1 &&
+            std::isalpha(static_cast<unsigned char>(first[0])) &&
+            std::isalpha(static_cast<unsigned char>(last[0])))
+        {
+            node.isAlphabetic = true;
+            firstValue = static_cast<unsigned char>(first[0]);
+            lastValue = static_cast<unsigned char>(last[0]);
+        }
+        else {
+            return false;
+        }
+
+        // As bash does, the sign of the step is that of the range
+        unsigned long long distance = (firstValue <= lastValue) ?
+            static_cast<unsigned long long>(lastValue) - firstValue :
+            static_cast<unsigned long long>(firstValue) - lastValue;
+        unsigned long long stepSize = (step == 0) ? 1 :
+            (step < 0) ? 0 - static_cast<unsigned long long>(step) :
+            static_cast<unsigned long long>(step);
+        unsigned long long size = distance / stepSize + 1;
+
+        node.type = Node::RANGE;
+        node.first = firstValue;
+        node.step = (firstValue <= lastValue) ?
+            static_cast<long long>(stepSize) :
+            -static_cast<long long>(stepSize);
+        node.size = (size > MAX_SIZE) ? MAX_SIZE :
+            static_cast<std::size_t>(size);
+        return true;
+    }
+
+    void BraceExpansion::generate(std::size_t sequence, std::size_t index,
+        Word& word) const
+    {
+        // The first node changes the slowest, as bash does
+        const SequenceType& nodes = sequences_[sequence];
+        std::vector<std::size_t> digits(nodes.size());
+        for (std::size_t i = nodes.size(); i-- > 0;) {
+            std::size_t size = nodes_[nodes[i]].size;
+            digits[i] = index % size;
+            index /= size;
+        }
+
+        for (std::size_t i = 0; i < nodes.size(); ++i) {
+            const Node& node = nodes_[nodes[i]];
+            switch (node.type) {
+            case Node::TEXT:
+                appendText(node.begin, node.end, word);
+                break;
+            case Node::RANGE:
+            {
+                long long value = node.first +
+                    static_cast<long long>(digits[i]) * node.step;
+                if (node.isAlphabetic) {
+                    word.text.push_back(static_cast<char>(value));
+                    break;
+                }
+
+                std::string number = std::to_string(value < 0 ?
+                    0 - static_cast<unsigned long long>(value) :
+                    static_cast<unsigned long long>(value));
+                int padding = node.width - static_cast<int>(number.size()) -
+                    (value < 0 ? 1 : 0);
+                if (value < 0) {
+                    word.text.push_back('-');
+                }
+                if (padding > 0) {
+                    word.text.append(padding, '0');
+                }
+                word.text += number;
+                break;
+            }
+            case Node::LIST:
+            {
+                std::size_t digit = digits[i];
+                for (std::vector<std::size_t>::const_iterator j =
+                    node.alternatives.begin(); j < node.alternatives.end();
+                    ++j)
+                {
+                    if (digit < sequenceSizes_[*j]) {
+                        generate(*j, digit, word);
+                        break;
+                    }
+                    digit -= sequenceSizes_[*j];
+                }
+                break;
+            }
+            }
+        }
+    }
+
+    void BraceExpansion::appendText(std::size_t begin, std::size_t end,
+        Word& word) const
+    {
+        std::size_t offset = word.text.size();
+        word.text.append(pattern_, begin, end - begin);
+
+        // The quoted ranges are moved with the text
+        for (QuotedRanges::const_iterator i = quoted_.begin();
+            i < quoted_.end(); ++i)
+        {
+            std::size_t quotedBegin = std::max(i->first, begin);
+            std::size_t quotedEnd = std::min(i->second, end);
+            if (quotedBegin >= quotedEnd) {
+                continue;
+            }
+
+            quotedBegin += offset - begin;
+            quotedEnd += offset - begin;
+            if (! word.quoted.empty() &&
+                word.quoted.back().second == quotedBegin)
+            {
+                word.quoted.back().second = quotedEnd;
+            }
+            else {
+                word.quoted.push_back(std::make_pair(quotedBegin,
+                    quotedEnd));
+            }
+        }
+    }
+
+    //
+    // Class GlobStream
+    //
+
+    namespace
+    {
+        void startProducer(GlobProducer& producer, const std::string& pattern,
+            const QuotedMask& quoted, GlobFlags flags,
+            const GlobOptions& options)
+        {
+            GlobProducer* ownProducer = &producer;
+            producer.thread = std::thread([=]()
+            {
+                try {
+                    GlobWalker walker(*ownProducer, flags, options);
+                    walker.glob(pattern, quoted);
+                }
+                catch (...) {
+                    // Read by the stream after it pops the end
+                    ownProducer->exception = std::current_exception();
+                }
+                ownProducer->push(GlobProducer::Item::END, std::string());
+            });
+        }
+    }
+
+    GlobStream::GlobStream(const std::string& pattern, GlobFlags flags,
+        const GlobOptions& options)
+        : producer_(new GlobProducer),
+          isFinished_(false)
+    {
+        startProducer(*producer_, pattern, QuotedMask(), flags, options);
+    }
+
+    GlobStream::GlobStream(const std::string& pattern,
+        const QuotedRanges& quoted, GlobFlags flags,
+        const GlobOptions& options)
+        : producer_(new GlobProducer),
+          isFinished_(false)
+    {
+        startProducer(*producer_, pattern,
+            makeQuotedMask(quoted, pattern.size()), flags, options);
+    }
+
+    GlobStream::~GlobStream()
+    {
+        finish();
+    }
+
+    bool GlobStream::onError(const std::string& pathName,
+        std::error_code errorCode)
+    {
+        return false;
+    }
+
+    bool GlobStream::next(std::string& pathName)
+    {
+        while (! isFinished_) {
+            GlobProducer::Item* item = producer_->ring.popSlot();
+            switch (item->type) {
+            case GlobProducer::Item::PATH_NAME:
+                // The old string is given to the slot to be reused
+                pathName.swap(item->pathName);
+                producer_->ring.pop();
+                return true;
+            case GlobProducer::Item::ERROR:
+                errors_.push_back(std::make_pair(item->pathName,
+                    item->errorCode));
+                producer_->ring.pop();
+                if (onError(errors_.back().first, errors_.back().second)) {
+                    finish();
+                }
+                break;
+            case GlobProducer::Item::END:
+                producer_->ring.pop();
+                finish();
+                if (producer_->exception) {
+                    std::rethrow_exception(producer_->exception);
+                }
+                break;
+            }
+        }
+        return false;
+    }
+
+    void GlobStream::finish()
+    {
+        if (! isFinished_) {
+            producer_->ring.close();
+            producer_->thread.join();
+            isFinished_ = true;
+        }
+    }
 }
@@ -0,0 +1,712 @@
+/*
+ * history.cpp - Persistent command history
+ *
+ *   Copyright 2010-2016 Jesús Torres <jmtorres@ull.es>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <unordered_set>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cli/history.hpp>
+
+namespace cli { namespace history
+{
+    //
+    // Class FileLock
+    //
+    // Holds an advisory lock on a file while it is in scope
+    //
+
+    struct FileLock
+    {
+        int fd;
+
+        FileLock(int fd, int operation)
+            : fd(fd)
+        {
+            while (::flock(fd, operation) == -1 && errno == EINTR);
+        }
+
+        ~FileLock()
+            { ::flock(fd, LOCK_UN); }
+    };
+
+    //
+    // Functions to parse history files
+    //
+
+    bool isTimestampLine(const char* begin, const char* end,
+        std::time_t& timestamp)
+    {
+        if (end - begin < 2 || *begin != '#') {
+            return false;
+        }
+
+        std::time_t value = 0;
+        for (const char* i = begin + 1; i < end; ++i) {
+            if (*i < '0' || *i > '9') {
+                return false;
+            }
+            value = value * 10 + (*i - '0');
+        }
+        timestamp = value;
+        return true;
+    }
+
+    //
+    // Invoke function(timestamp, begin, end) for every entry in the buffer
+    //
+
+    template <typename Function>
+    void parseEntries(const char* begin, const char* end,
+        const Function& function)
+    {
+        std::time_t timestamp = 0;
+        while (begin < end) {
+            const char* newline = static_cast<const char*>(
+                std::memchr(begin, '\n', end - begin));
+            const char* lineEnd = (newline == NULL) ? end : newline;
+            if (! isTimestampLine(begin, lineEnd, timestamp) &&
+                begin < lineEnd)
+            {
+                function(timestamp, begin, lineEnd);
+                timestamp = 0;
+            }
+            begin = lineEnd + 1;
+        }
+    }
+
+    bool readFile(int fd, off_t begin, off_t end, std::string& data)
+    {
+        data.resize(end - begin);
+        std::size_t done = 0;
+        while (done < data.size()) {
+            ssize_t count = ::pread(fd, &data[done], data.size() - done,
+                begin + done);
+            if (count == -1 && errno == EINTR) {
+                continue;
+            }
+            else if (count <= 0) {
+                return false;
+            }
+            done += count;
+        }
+        return true;
+    }
+
+    bool writeFile(int fd, const char* data, std::size_t size)
+    {
+        while (size > 0) {
+            ssize_t count = ::write(fd, data, size);
+            if (count == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            data += count;
+            size -= count;
+        }
+        return true;
+    }
+
+    //
+    // Class HistoryIndex
+    //
+
+    void HistoryIndex::add(const std::string& entry)
+    {
+        std::uint32_t position = entries_.size();
+        entries_.push_back(entry);
+
+        for (std::size_t i = 0; i + 3 <= entry.size(); ++i) {
+            Trigram trigram = trigramAt(entry, i);
+
+            // Positions are added in increasing order, so a repeated trigram
+            // of the same entry is always the last element
+            std::vector<std::uint32_t>& positions = postings_[trigram];
+            if (positions.empty() || positions.back() != position) {
+                positions.push_back(position);
+            }
+        }
+    }
+
+    std::vector<std::size_t> HistoryIndex::search(const std::string& query,
+        MatchType type, std::size_t count, std::size_t before) const
+    {
+        std::vector<std::size_t> found;
+        before = std::min(before, entries_.size());
+
+        // Avoid returning the same command several times
+        auto addMatch = [this, &found](std::size_t position)
+        {
+            for (std::vector<std::size_t>::const_iterator i = found.begin();
+                i < found.end(); ++i)
+            {
+                if (entries_[*i] == entries_[position]) {
+                    return;
+                }
+            }
+            found.push_back(position);
+        };
+
+        if (query.size() < 3) {
+            for (std::size_t i = before; i > 0 && found.size() < count; --i) {
+                if (isMatch(entries_[i - 1], query, type)) {
+                    addMatch(i - 1);
+                }
+            }
+            return found;
+        }
+
+        // Entries must appear in the posting lists of all the trigrams.
+        // The shortest list is walked and the rest are binary searched.
+        std::vector<const std::vector<std::uint32_t>*> lists;
+        for (std::size_t i = 0; i + 3 <= query.size(); ++i) {
+            Trigram trigram = trigramAt(query, i);
+
+            std::unordered_map<Trigram, std::vector<std::uint32_t> >::
+                const_iterator postings = postings_.find(trigram);
+            if (postings == postings_.end()) {
+                return found;
+            }
+            lists.push_back(&postings->second);
+        }
+        std::sort(lists.begin(), lists.end(),
+            [](const std::vector<std::uint32_t>* a,
+                const std::vector<std::uint32_t>* b)
+            {
+                return a->size() < b->size();
+            });
+
+        const std::vector<std::uint32_t>& shortest = *lists.front();
+        std::vector<std::uint32_t>::const_iterator end =
+            std::lower_bound(shortest.begin(), shortest.end(), before);
+        for (std::vector<std::uint32_t>::const_iterator i = end;
+            i != shortest.begin() && found.size() < count;)
+        {
+            std::uint32_t position = *(--i);
+
+            bool isCandidate = true;
+            for (std::size_t j = 1; j < lists.size() && isCandidate; ++j) {
+                isCandidate = std::binary_search(lists[j]->begin(),
+                    lists[j]->end(), position);
+            }
+            if (isCandidate && isMatch(entries_[position], query, type)) {
+                addMatch(position);
+            }
+        }
+        return found;
+    }
+
+    HistoryIndex::Trigram HistoryIndex::trigramAt(const std::string& text,
+        std::size_t i)
+    {
+        const unsigned char* c =
+            reinterpret_cast<const unsigned char*>(text.data() + i);
+        return (static_cast<Trigram>(c[0]) << 16) |
+            (static_cast<Trigram>(c[1]) << 8) | static_cast<Trigram>(c[2]);
+    }
+
+    bool HistoryIndex::isMatch(const std::string& entry,
+        const std::string& query, MatchType type)
+    {
+        if (type == MatchType::PREFIX) {
+            return entry.compare(0, query.size(), query) == 0;
+        }
+        return entry.find(query) != std::string::npos;
+    }
+
+    //
+    // Class HistoryStore
+    //
+
+    const std::chrono::seconds HistoryStore::DEFAULT_COMPACTION_INTERVAL(10);
+
+    HistoryStore::HistoryStore(const std::string& fileName,
+        std::size_t windowSize)
+        : fileName_(fileName),
+          lockFileName_(fileName + ".lock"),
+          windowSize_(windowSize),
+          isLoaded_(false),
+          isCompactionStopping_(false),
+          maxEntries_(DEFAULT_MAX_ENTRIES),
+          mergeInode_(0),
+          mergeOffset_(0),
+          mergeTimestamp_(0),
+          compactedSize_(0)
+    {
+        fd_ = ::open(fileName.c_str(), O_RDWR | O_APPEND | O_CREAT |
+            O_CLOEXEC, 0600);
+        if (fd_ == -1) {
+            throw std::system_error(errno, std::system_category(),
+                "cannot open history file '" + fileName + "'");
+        }
+
+        lockFd_ = ::open(lockFileName_.c_str(), O_RDWR | O_CREAT |
+            O_CLOEXEC, 0600);
+        compactionLockFd_ = (lockFd_ == -1) ? -1 :
+            ::open(lockFileName_.c_str(), O_RDWR | O_CLOEXEC);
+        if (compactionLockFd_ == -1) {
+            int error = errno;
+            if (lockFd_ != -1) {
+                ::close(lockFd_);
+            }
+            ::close(fd_);
+            throw std::system_error(error, std::system_category(),
+                "cannot open history lock file '" + lockFileName_ + "'");
+        }
+    }
+
+    HistoryStore::~HistoryStore()
+    {
+        stopCompaction();
+        ::close(compactionLockFd_);
+        ::close(lockFd_);
+        ::close(fd_);
+    }
+
+    void HistoryStore::append(const std::string& line)
+    {
+        // Lines can not span several lines of the file
+        std::string entry = "#" + std::to_string(
+            static_cast<long long>(std::time(NULL))) + "\n" + line + "\n";
+        std::replace(entry.begin() + entry.find('\n') + 1, entry.end() - 1,
+            '\n', ' ');
+
+        int error = 0;
+        {
+            FileLock lock(lockFd_, LOCK_EX);
+            reopenIfReplaced();
+            if (! writeFile(fd_, entry.data(), entry.size())) {
+                error = errno;
+            }
+        }
+
+        // The compaction thread must not take it as an entry of other
+        // process
+        if (compactionThread_.joinable()) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ownEntries_.push_back(line);
+            if (ownEntries_.size() > windowSize_) {
+                ownEntries_.pop_front();
+            }
+        }
+
+        if (isLoaded_) {
+            window_.push_back(line);
+            if (window_.size() > windowSize_) {
+                window_.pop_front();
+            }
+        }
+        if (index_) {
+            index_->add(line);
+        }
+
+        if (error != 0) {
+            throw std::system_error(error, std::system_category(),
+                "cannot write history file '" + fileName_ + "'");
+        }
+    }
+
+    const std::deque<std::string>& HistoryStore::entries()
+    {
+        if (! isLoaded_) {
+            load();
+        }
+        return window_;
+    }
+
+    const HistoryIndex& HistoryStore::index()
+    {
+        if (! index_) {
+            loadIndex();
+        }
+        return *index_;
+    }
+
+    void HistoryStore::load()
+    {
+        isLoaded_ = true;
+        window_.clear();
+
+        FileLock lock(lockFd_, LOCK_SH);
+        reopenIfReplaced();
+
+        struct stat status;
+        if (::fstat(fd_, &status) == -1 || status.st_size == 0) {
+            return;
+        }
+
+        std::size_t size = status.st_size;
+        void* data = ::mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd_, 0);
+        if (data == MAP_FAILED) {
+            return;
+        }
+
+        // Only the pages at the end of the file are touched
+        const char* begin = static_cast<const char*>(data);
+        const char* end = begin + size;
+        if (end[-1] == '\n') {
+            --end;
+        }
+        while (window_.size() < windowSize_ && end > begin) {
+            const char* newline = static_cast<const char*>(
+                ::memrchr(begin, '\n', end - begin));
+            const char* lineBegin = (newline == NULL) ? begin : newline + 1;
+
+            std::time_t timestamp;
+            if (lineBegin < end &&
+                ! isTimestampLine(lineBegin, end, timestamp))
+            {
+                window_.push_front(std::string(lineBegin, end));
+            }
+            if (newline == NULL) {
+                break;
+            }
+            end = newline;
+        }
+
+        ::munmap(data, size);
+    }
+
+    void HistoryStore::loadIndex()
+    {
+        index_.reset(new HistoryIndex);
+
+        FileLock lock(lockFd_, LOCK_SH);
+        reopenIfReplaced();
+
+        struct stat status;
+        if (::fstat(fd_, &status) == -1 || status.st_size == 0) {
+            return;
+        }
+
+        std::size_t size = status.st_size;
+        void* data = ::mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd_, 0);
+        if (data == MAP_FAILED) {
+            return;
+        }
+        ::madvise(data, size, MADV_SEQUENTIAL);
+
+        const char* begin = static_cast<const char*>(data);
+        HistoryIndex& index = *index_;
+        parseEntries(begin, begin + size,
+            [&index](std::time_t, const char* begin, const char* end)
+            {
+                index.add(std::string(begin, end));
+            });
+
+        ::munmap(data, size);
+    }
+
+    //
+    // The file is replaced when it is compacted, so the descriptor must be
+    // checked with the lock held before using it
+    //
+
+    void HistoryStore::reopenIfReplaced()
+    {
+        struct stat fileStatus, fdStatus;
+        if (::stat(fileName_.c_str(), &fileStatus) == 0 &&
+            ::fstat(fd_, &fdStatus) == 0 &&
+            fileStatus.st_ino == fdStatus.st_ino &&
+            fileStatus.st_dev == fdStatus.st_dev)
+        {
+            return;
+        }
+
+        int fd = ::open(fileName_.c_str(), O_RDWR | O_APPEND | O_CREAT |
+            O_CLOEXEC, 0600);
+        if (fd != -1) {
+            ::close(fd_);
+            fd_ = fd;
+        }
+    }
+
+    //
+    // Members to keep the history file compacted and merged
+    //
+
+    void HistoryStore::startCompaction(std::chrono::seconds interval,
+        std::size_t maxEntries)
+    {
+        if (compactionThread_.joinable()) {
+            return;
+        }
+
+        // Entries already in the file are loaded by entries() and index()
+        {
+            FileLock lock(lockFd_, LOCK_SH);
+            reopenIfReplaced();
+            struct stat status;
+            if (::fstat(fd_, &status) == 0) {
+                mergeInode_ = status.st_ino;
+                mergeOffset_ = status.st_size;
+                compactedSize_ = status.st_size;
+            }
+        }
+        mergeTimestamp_ = std::time(NULL);
+        maxEntries_ = maxEntries;
+        isCompactionStopping_ = false;
+        compactionThread_ = std::thread(&HistoryStore::compactionLoop, this,
+            interval);
+    }
+
+    void HistoryStore::stopCompaction()
+    {
+        if (! compactionThread_.joinable()) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            isCompactionStopping_ = true;
+        }
+        condition_.notify_all();
+        compactionThread_.join();
+    }
+
+    std::vector<std::string> HistoryStore::mergeEntries()
+    {
+        std::vector<std::string> entries;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            entries.swap(mergedEntries_);
+        }
+
+        for (std::vector<std::string>::const_iterator i = entries.begin();
+            i < entries.end(); ++i)
+        {
+            if (isLoaded_) {
+                window_.push_back(*i);
+                if (window_.size() > windowSize_) {
+                    window_.pop_front();
+                }
+            }
+            if (index_) {
+                index_->add(*i);
+            }
+        }
+        return entries;
+    }
+
+    void HistoryStore::compactionLoop(std::chrono::seconds interval)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (! isCompactionStopping_) {
+            condition_.wait_for(lock, interval);
+            if (isCompactionStopping_) {
+                break;
+            }
+            lock.unlock();
+
+            {
+                std::lock_guard<std::mutex> compactionLock(compactionMutex_);
+                collectEntries();
+            }
+
+            struct stat status;
+            if (::stat(fileName_.c_str(), &status) == 0 &&
+                status.st_size >= 2 * compactedSize_ &&
+                status.st_size > 4096)
+            {
+                compact();
+            }
+
+            lock.lock();
+        }
+    }
+
+    //
+    // Collect the entries appended by other processes since the last time.
+    // If the file was replaced, the entries newer than the last one
+    // collected are taken from the new file.
+    //
+
+    void HistoryStore::collectEntries()
+    {
+        FileLock lock(compactionLockFd_, LOCK_SH);
+
+        int fd = ::open(fileName_.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            return;
+        }
+
+        struct stat status;
+        if (::fstat(fd, &status) == 0) {
+            if (status.st_ino != mergeInode_) {
+                collectEntries(fd, 0, status.st_size, mergeTimestamp_);
+                mergeInode_ = status.st_ino;
+            }
+            else if (status.st_size > mergeOffset_) {
+                collectEntries(fd, mergeOffset_, status.st_size, 0);
+            }
+            mergeOffset_ = status.st_size;
+        }
+        ::close(fd);
+    }
+
+    void HistoryStore::collectEntries(int fd, off_t begin, off_t end,
+        std::time_t minTimestamp)
+    {
+        std::string data;
+        if (! readFile(fd, begin, end, data)) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        parseEntries(data.data(), data.data() + data.size(),
+            [this, minTimestamp](std::time_t timestamp, const char* begin,
+                const char* end)
+            {
+                std::string line(begin, end);
+                mergeTimestamp_ = std::max(mergeTimestamp_, timestamp);
+                if (! ownEntries_.empty() && ownEntries_.front() == line) {
+                    ownEntries_.pop_front();
+                }
+                else if (timestamp >= minTimestamp) {
+                    mergedEntries_.push_back(line);
+                }
+            });
+    }
+
+    //
+    // The file is read with a shared lock, so no entry is half written,
+    // and compacted without holding the lock, so other processes can keep
+    // appending. Then the lock is taken only to copy what was appended
+    // meanwhile and to replace the file.
+    //
+
+    void HistoryStore::compact()
+    {
+        std::lock_guard<std::mutex> compactionLock(compactionMutex_);
+
+        int fd;
+        struct stat status;
+        std::string data;
+        {
+            FileLock lock(compactionLockFd_, LOCK_SH);
+
+            fd = ::open(fileName_.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd == -1) {
+                return;
+            }
+
+            if (::fstat(fd, &status) == -1 ||
+                ! readFile(fd, 0, status.st_size, data))
+            {
+                ::close(fd);
+                return;
+            }
+            ::close(fd);
+        }
+
+        std::vector<Entry> entries;
+        parseEntries(data.data(), data.data() + data.size(),
+            [&entries](std::time_t timestamp, const char* begin,
+                const char* end)
+            {
+                Entry entry = { timestamp, std::string(begin, end) };
+                entries.push_back(entry);
+            });
+
+        // Keep the most recent of the duplicated entries
+        std::unordered_set<std::string> seen;
+        std::vector<const Entry*> kept;
+        for (std::vector<Entry>::const_reverse_iterator i = entries.rbegin();
+            i != entries.rend() && kept.size() < maxEntries_; ++i)
+        {
+            if (seen.insert(i->line).second) {
+                kept.push_back(&*i);
+            }
+        }
+
+        std::string compacted;
+        for (std::vector<const Entry*>::const_reverse_iterator i =
+            kept.rbegin(); i != kept.rend(); ++i)
+        {
+            if ((*i)->timestamp != 0) {
+                compacted += "#" + std::to_string(
+                    static_cast<long long>((*i)->timestamp)) + "\n";
+            }
+            compacted += (*i)->line;
+            compacted += '\n';
+        }
+
+        std::string tempFileName = fileName_ + ".tmp" +
+            std::to_string(static_cast<long long>(::getpid()));
+        int tempFd = ::open(tempFileName.c_str(), O_WRONLY | O_CREAT |
+            O_TRUNC | O_CLOEXEC, 0600);
+        if (tempFd == -1) {
+            return;
+        }
+        bool isOk = writeFile(tempFd, compacted.data(), compacted.size());
+
+        {
+            FileLock lock(compactionLockFd_, LOCK_EX);
+
+            struct stat current;
+            fd = ::open(fileName_.c_str(), O_RDONLY | O_CLOEXEC);
+            isOk = isOk && fd != -1 && ::fstat(fd, &current) == 0 &&
+                current.st_ino == status.st_ino;
+
+            // Copy the entries appended while compacting
+            if (isOk && current.st_size > status.st_size) {
+                isOk = readFile(fd, status.st_size, current.st_size, data) &&
+                    writeFile(tempFd, data.data(), data.size());
+            }
+
+            // Entries of other processes must be collected before the file
+            // is replaced, so they are not taken again from the new one
+            if (isOk && current.st_ino == mergeInode_) {
+                collectEntries(fd, mergeOffset_, current.st_size, 0);
+            }
+            if (fd != -1) {
+                ::close(fd);
+            }
+
+            struct stat compactedStatus;
+            isOk = isOk && ::fsync(tempFd) == 0 &&
+                ::fstat(tempFd, &compactedStatus) == 0;
+            ::close(tempFd);
+            if (isOk && ::rename(tempFileName.c_str(),
+                fileName_.c_str()) == 0)
+            {
+                compactedSize_ = compacted.size();
+                if (current.st_ino == mergeInode_) {
+                    mergeInode_ = compactedStatus.st_ino;
+                    mergeOffset_ = compactedStatus.st_size;
+                }
+            }
+            else {
+                ::unlink(tempFileName.c_str());
+            }
+        }
+    }
+}}
@@ -0,0 +1,173 @@
+/*
+ * memoize.cpp - Cache of the results of commands without side effects
+ *
+ *   Copyright 2010-2016 Jesús Torres <jmtorres@ull.es>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include <cli/memoize.hpp>
+
+namespace cli { namespace memoize
+{
+    void appendDependenciesKey(std::string& key,
+        const std::vector<std::string>& paths)
+    {
+        for (std::vector<std::string>::const_iterator i = paths.begin();
+            i < paths.end(); ++i)
+        {
+            appendKey(key, *i);
+
+            struct stat status;
+            if (::stat(i->c_str(), &status) == -1) {
+                key += '-';
+                continue;
+            }
+            appendKey(key, status.st_mtim.tv_sec);
+            appendKey(key, status.st_mtim.tv_nsec);
+            appendKey(key, status.st_size);
+            appendKey(key, status.st_ino);
+        }
+    }
+
+    //
+    // Class ResultCache
+    //
+
+    ResultCache::ResultCache(std::size_t budget)
+        : budget_(budget),
+          size_(0),
+          hits_(0),
+          misses_(0)
+    {}
+
+    bool ResultCache::lookup(const std::string& key, CachedResult& result)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        std::unordered_map<std::string, EntriesType::iterator>::iterator i =
+            index_.find(key);
+        if (i == index_.end()) {
+            ++misses_;
+            return false;
+        }
+
+        ++hits_;
+        entries_.splice(entries_.begin(), entries_, i->second);
+        result = i->second->second;
+        return true;
+    }
+
+    void ResultCache::insert(const std::string& key,
+        const CachedResult& result)
+    {
+        std::size_t entrySize = key.size() + result.output.size();
+
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        std::unordered_map<std::string, EntriesType::iterator>::iterator i =
+            index_.find(key);
+        if (i != index_.end()) {
+            size_ -= i->first.size() + i->second->second.output.size();
+            entries_.erase(i->second);
+            index_.erase(i);
+        }
+
+        if (entrySize > budget_) {
+            return;
+        }
+
+        shrink(budget_ - entrySize);
+        entries_.push_front(std::make_pair(key, result));
+        index_[key] = entries_.begin();
+        size_ += entrySize;
+    }
+
+    void ResultCache::clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        shrink(0);
+    }
+
+    void ResultCache::budget(std::size_t budget)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        budget_ = budget;
+        shrink(budget_);
+    }
+
+    std::size_t ResultCache::budget() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return budget_;
+    }
+
+    std::size_t ResultCache::size() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return size_;
+    }
+
+    unsigned long long ResultCache::hits() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return hits_;
+    }
+
+    unsigned long long ResultCache::misses() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return misses_;
+    }
+
+    void ResultCache::shrink(std::size_t budget)
+    {
+        while (size_ > budget) {
+            EntriesType::iterator last = --entries_.end();
+            size_ -= last->first.size() + last->second.output.size();
+            index_.erase(last->first);
+            entries_.erase(last);
+        }
+    }
+
+    //
+    // Class CaptureBuffer
+    //
+
+    CaptureBuffer::int_type CaptureBuffer::overflow(int_type c)
+    {
+        if (traits_type::eq_int_type(c, traits_type::eof())) {
+            return traits_type::not_eof(c);
+        }
+        captured_.push_back(traits_type::to_char_type(c));
+        return buffer_->sputc(traits_type::to_char_type(c));
+    }
+
+    std::streamsize CaptureBuffer::xsputn(const char_type* s,
+        std::streamsize n)
+    {
+        captured_.append(s, n);
+        return buffer_->sputn(s, n);
+    }
+
+    int CaptureBuffer::sync()
+    {
+        return buffer_->pubsync();
+    }
+}}
@@ -27,10 +27,8 @@ namespace cli { namespace prettyprint { namespace detail
     const int INDENT_DEFAULT_WIDTH = 4;
 
     //
-    // Indexes in stream internal extensible array
+    // Index in stream internal extensible array
     //
 
-    const int PRETTYPRINT_ENABLED_FLAG_INDEX = std::ios_base::xalloc();
-    const int INDENT_SPACE_INDEX = std::ios_base::xalloc();
-    const int INDENT_WIDTH_INDEX = std::ios_base::xalloc();
+    const int STATE_INDEX = std::ios_base::xalloc();
 }}}
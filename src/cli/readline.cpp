@@ -16,10 +16,17 @@
  * limitations under the License.
  */
 
+#include <cerrno>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <deque>
 #include <iostream>
 #include <string>
+#include <system_error>
+#include <vector>
+
+#include <unistd.h>
 
 #include <cli/detail/utility.hpp>
 #include <cli/readline.hpp>
@@ -46,7 +53,8 @@ namespace cli { namespace readline
     //
 
     ReadlineLibrary::ReadlineLibrary() : dl::DynamicLibrary(),
-        rl_instream_(NULL), rl_outstream_(NULL)
+        rl_instream_(NULL), rl_outstream_(NULL), rl_line_buffer_(NULL),
+        rl_point_(NULL)
     {
         // Try to load some readline libray
         for (const char** library = LIBREADLINE_FILENAMES; *library != NULL;
@@ -97,7 +105,7 @@ namespace cli { namespace readline
     }
 
 #define READLINELIBRARY_VARIABLE(VARIABLE_PTR, SYMBOL)      \
-    if (*VARIABLE_PTR == NULL) {                            \
+    if (VARIABLE_PTR == NULL) {                             \
         resolve(VARIABLE_PTR, SYMBOL);                      \
         if (lastError()) {                                  \
             return;                                         \
@@ -136,6 +144,97 @@ namespace cli { namespace readline
         clear_history_();
     }
 
+    void ReadlineLibrary::stifleHistory(int max)
+    {
+        READLINELIBRARY_FUNCTION(stifle_history_, "stifle_history");
+        stifle_history_(max);
+    }
+
+    //
+    // Methods for the alternate interface
+    //
+
+    ReadlineLibrary* ReadlineLibrary::lineHandlerObject_ = NULL;
+
+    void ReadlineLibrary::lineHandler(char* line)
+    {
+        if (lineHandlerObject_ != NULL) {
+            lineHandlerObject_->lineHandler_(line);
+        }
+    }
+
+    void ReadlineLibrary::callbackHandlerInstall(const std::string& prompt,
+        const std::function<void (char*)>& handler)
+    {
+        // All the symbols are resolved here, so the others can not fail
+        READLINELIBRARY_FUNCTION(rl_callback_handler_install_,
+            "rl_callback_handler_install");
+        READLINELIBRARY_FUNCTION(rl_callback_read_char_,
+            "rl_callback_read_char");
+        READLINELIBRARY_FUNCTION(rl_callback_handler_remove_,
+            "rl_callback_handler_remove");
+        READLINELIBRARY_FUNCTION(rl_set_prompt_, "rl_set_prompt");
+
+        lineHandler_ = handler;
+        lineHandlerObject_ = this;
+        rl_callback_handler_install_(prompt.c_str(),
+            &ReadlineLibrary::lineHandler);
+    }
+
+    void ReadlineLibrary::callbackReadChar()
+    {
+        if (rl_callback_read_char_) {
+            rl_callback_read_char_();
+        }
+    }
+
+    void ReadlineLibrary::callbackHandlerRemove()
+    {
+        if (rl_callback_handler_remove_) {
+            rl_callback_handler_remove_();
+        }
+        if (lineHandlerObject_ == this) {
+            lineHandlerObject_ = NULL;
+        }
+    }
+
+    void ReadlineLibrary::setPrompt(const std::string& prompt)
+    {
+        if (rl_set_prompt_) {
+            rl_set_prompt_(prompt.c_str());
+        }
+    }
+
+    //
+    // Methods for key binding and line editing
+    //
+
+    void ReadlineLibrary::bindKeySequence(const std::string& keySequence,
+        CommandSignature* function)
+    {
+        READLINELIBRARY_FUNCTION(rl_bind_keyseq_, "rl_bind_keyseq");
+        rl_bind_keyseq_(keySequence.c_str(), function);
+    }
+
+    std::string ReadlineLibrary::lineBuffer()
+    {
+        if (rl_line_buffer_ == NULL) {
+            resolve(rl_line_buffer_, "rl_line_buffer");
+            if (lastError()) {
+                return std::string();
+            }
+        }
+        return (*rl_line_buffer_ != NULL) ? *rl_line_buffer_ : "";
+    }
+
+    void ReadlineLibrary::replaceLine(const std::string& text)
+    {
+        READLINELIBRARY_FUNCTION(rl_replace_line_, "rl_replace_line");
+        READLINELIBRARY_VARIABLE(rl_point_, "rl_point");
+        rl_replace_line_(text.c_str(), 0);
+        *rl_point_ = text.size();
+    }
+
     //
     // I/0 streams setters
     //
@@ -178,42 +277,283 @@ namespace cli { namespace readline
         errorCode_.clear();
     }
 
+    //
+    // Class FileLineReader
+    //
+    // Reads lines from a file descriptor in large blocks, avoiding the
+    // overhead of the extraction from C++ streams. Any data already
+    // buffered by the stream owning the descriptor is not seen.
+    //
+
+    class FileLineReader
+    {
+        public:
+            static const std::size_t DEFAULT_BUFFER_SIZE = 64 * 1024;
+
+            FileLineReader(int fd, std::size_t bufferSize =
+                DEFAULT_BUFFER_SIZE);
+
+            bool readLine(std::string& line);
+
+            //
+            // Read once from the file descriptor and append the complete
+            // lines to 'lines'. It returns false at the end of the input,
+            // after appending the last line if it does not end with a
+            // newline.
+            //
+
+            bool readAvailable(std::vector<std::string>& lines);
+
+        private:
+            int fd_;
+            std::vector<char> buffer_;
+            std::size_t begin_;
+            std::size_t end_;
+    };
+
+    FileLineReader::FileLineReader(int fd, std::size_t bufferSize)
+        : fd_(fd), buffer_(bufferSize), begin_(0), end_(0)
+    {}
+
+    bool FileLineReader::readLine(std::string& line)
+    {
+        line.clear();
+        bool isLineRead = false;
+        while (true) {
+            const char* begin = &buffer_[begin_];
+            const char* newline = static_cast<const char*>(
+                std::memchr(begin, '\n', end_ - begin_));
+            if (newline != NULL) {
+                line.append(begin, newline);
+                begin_ += newline - begin + 1;
+                return true;
+            }
+
+            if (begin_ < end_) {
+                line.append(begin, end_ - begin_);
+                isLineRead = true;
+            }
+            begin_ = end_ = 0;
+
+            ssize_t count = ::read(fd_, &buffer_[0], buffer_.size());
+            if (count == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::system_error(errno, std::system_category(),
+                    "unexpected error reading from input stream");
+            }
+            else if (count == 0) {
+                // The last line may not end with a newline
+                return isLineRead;
+            }
+            end_ = count;
+        }
+    }
+
+    bool FileLineReader::readAvailable(std::vector<std::string>& lines)
+    {
+        // Move the incomplete line to the beginning of the buffer
+        if (begin_ > 0) {
+            std::memmove(&buffer_[0], &buffer_[begin_], end_ - begin_);
+            end_ -= begin_;
+            begin_ = 0;
+        }
+        if (end_ == buffer_.size()) {
+            buffer_.resize(buffer_.size() * 2);
+        }
+
+        ssize_t count;
+        do {
+            count = ::read(fd_, &buffer_[end_], buffer_.size() - end_);
+        } while (count == -1 && errno == EINTR);
+
+        if (count == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true;
+            }
+            throw std::system_error(errno, std::system_category(),
+                "unexpected error reading from input stream");
+        }
+        else if (count == 0) {
+            if (begin_ < end_) {
+                lines.push_back(std::string(&buffer_[begin_], end_ - begin_));
+                begin_ = end_ = 0;
+            }
+            return false;
+        }
+        end_ += count;
+
+        while (true) {
+            const char* begin = &buffer_[begin_];
+            const char* newline = static_cast<const char*>(
+                std::memchr(begin, '\n', end_ - begin_));
+            if (newline == NULL) {
+                break;
+            }
+            lines.push_back(std::string(begin, newline));
+            begin_ += newline - begin + 1;
+        }
+        return true;
+    }
+
     //
     // Class Readline
     //
 
     Readline::Readline(bool useLibrary)
         : readlineLibrary_(useLibrary ? new ReadlineLibrary() : NULL),
-          in_(&std::cin), out_(&std::cout)
+          in_(&std::cin), out_(&std::cout), isInteractive_(false),
+          isReading_(false), searchPosition_(0)
     {
         if (readlineLibrary_ && readlineLibrary_->lastError()) {
             readlineLibrary_.reset();
         }
+
+        int fd = ::fileno(*in_);
+        isInteractive_ = (fd != -1) && (::isatty(fd) != 0);
+        if ((! readlineLibrary_) && fd != -1) {
+            fileLineReader_.reset(new FileLineReader(fd));
+        }
     }
 
     Readline::~Readline()
     {
-        if (readlineLibrary_ && (! historyFileName_.empty())) {
-            readlineLibrary_->writeHistory(historyFileName_);
-        }
+        stopReading();
     }
 
     bool Readline::readLine(std::string& line, const std::string& prompt) const
     {
         if (readlineLibrary_) {
+            mergeHistory();
             bool isOk = readlineLibrary_->readLine(line, prompt);
-            if (isOk && (! utility::detail::isLineEmpty(line))) {
-                readlineLibrary_->addHistory(line);
+            if (isOk) {
+                addHistory(line);
             }
             return isOk;
         }
         else {
-            *out_ << prompt;
-            std::getline(*in_, line);
-            return in_->good();
+            if (isInteractive_) {
+                *out_ << prompt << std::flush;
+            }
+            if (fileLineReader_) {
+                return fileLineReader_->readLine(line);
+            }
+            return static_cast<bool>(std::getline(*in_, line));
+        }
+    }
+
+    //
+    // Non-blocking interface
+    //
+
+    void Readline::startReading(const std::string& prompt,
+        const LineHandler& handler)
+    {
+        stopReading();
+        prompt_ = prompt;
+        lineHandler_ = handler;
+        isReading_ = true;
+
+        if (readlineLibrary_) {
+            readlineLibrary_->callbackHandlerInstall(prompt,
+                [this](char* c_line)
+            {
+                if (c_line == NULL) {
+                    stopReading();
+                    return;
+                }
+
+                std::string line(c_line);
+                free(c_line);
+                addHistory(line);
+                if (lineHandler_(line)) {
+                    stopReading();
+                }
+                else {
+                    mergeHistory();
+                }
+            });
+
+            std::error_code errorCode = readlineLibrary_->lastError();
+            if (errorCode) {
+                isReading_ = false;
+                throw std::system_error(errorCode,
+                    "unexpected error installing readline line handler");
+            }
+        }
+        else if (isInteractive_) {
+            *out_ << prompt_ << std::flush;
+        }
+    }
+
+    void Readline::prompt(const std::string& prompt)
+    {
+        prompt_ = prompt;
+        if (readlineLibrary_ && isReading_) {
+            readlineLibrary_->setPrompt(prompt);
+        }
+    }
+
+    bool Readline::readAvailable()
+    {
+        if (! isReading_) {
+            return false;
+        }
+
+        if (readlineLibrary_) {
+            readlineLibrary_->callbackReadChar();
+            return isReading_;
+        }
+
+        std::vector<std::string> lines;
+        bool isOk;
+        if (fileLineReader_) {
+            isOk = fileLineReader_->readAvailable(lines);
+        }
+        else {
+            std::string line;
+            isOk = static_cast<bool>(std::getline(*in_, line));
+            if (isOk) {
+                lines.push_back(line);
+            }
+        }
+
+        for (std::vector<std::string>::const_iterator i = lines.begin();
+            i < lines.end(); ++i)
+        {
+            if (lineHandler_(*i)) {
+                stopReading();
+                return false;
+            }
+        }
+
+        if (! isOk) {
+            stopReading();
+            return false;
+        }
+        if (isInteractive_) {
+            *out_ << prompt_ << std::flush;
+        }
+        return true;
+    }
+
+    void Readline::stopReading()
+    {
+        if (! isReading_) {
+            return;
+        }
+        isReading_ = false;
+        if (readlineLibrary_) {
+            readlineLibrary_->callbackHandlerRemove();
         }
     }
 
+    int Readline::inDescriptor() const
+    {
+        return ::fileno(*in_);
+    }
+
     //
     // Standard I/O streams setters
     //
@@ -221,7 +561,21 @@ namespace cli { namespace readline
     void Readline::inStream(std::istream& in)
     {
         in_ = &in;
-        if (readlineLibrary_) {
+        fileLineReader_.reset();
+
+        // The readline library can only read from file descriptors
+        int fd = ::fileno(in);
+        if (fd == -1) {
+            readlineLibrary_.reset();
+            isInteractive_ = false;
+            return;
+        }
+        isInteractive_ = ::isatty(fd) != 0;
+
+        if (! readlineLibrary_) {
+            fileLineReader_.reset(new FileLineReader(fd));
+        }
+        else {
             readlineLibrary_->inStream(in);
             std::error_code errorCode = readlineLibrary_->lastError();
             if (errorCode) {
@@ -234,6 +588,17 @@ namespace cli { namespace readline
     void Readline::outStream(std::ostream& out)
     {
         out_ = &out;
+
+        // The readline library can only write to file descriptors. The
+        // reader is kept if there is one, so no buffered input is lost.
+        if (::fileno(out) == -1) {
+            readlineLibrary_.reset();
+            if (! fileLineReader_ && ::fileno(*in_) != -1) {
+                fileLineReader_.reset(new FileLineReader(::fileno(*in_)));
+            }
+            return;
+        }
+
         if (readlineLibrary_) {
             readlineLibrary_->outStream(out);
             std::error_code errorCode = readlineLibrary_->lastError();
@@ -252,10 +617,21 @@ namespace cli { namespace readline
         bool loadInHistory)
     {
         if (readlineLibrary_) {
-            historyFileName_ = fileName;
+            historyStore_.reset(new cli::history::HistoryStore(fileName));
+            readlineLibrary_->stifleHistory(historyStore_->windowSize());
             if (loadInHistory) {
-                readlineLibrary_->readHistory(fileName);
+                const std::deque<std::string>& entries =
+                    historyStore_->entries();
+                for (std::deque<std::string>::const_iterator i =
+                    entries.begin(); i != entries.end(); ++i)
+                {
+                    readlineLibrary_->addHistory(*i);
+                }
             }
+
+            // Lines typed in other sessions are merged by a background
+            // thread and added to the history before every prompt
+            historyStore_->startCompaction();
         }
     }
 
@@ -265,4 +641,93 @@ namespace cli { namespace readline
             readlineLibrary_->clearHistory();
         }
     }
+
+    void Readline::addHistory(const std::string& line) const
+    {
+        if (utility::detail::isLineEmpty(line)) {
+            return;
+        }
+        readlineLibrary_->addHistory(line);
+        if (historyStore_) {
+            try {
+                historyStore_->append(line);
+            }
+            catch (const std::system_error& e) {
+                historyError_ = e.what();
+            }
+        }
+    }
+
+    std::string Readline::takeHistoryError()
+    {
+        std::string error;
+        error.swap(historyError_);
+        return error;
+    }
+
+    void Readline::mergeHistory() const
+    {
+        if (! historyStore_) {
+            return;
+        }
+
+        std::vector<std::string> entries = historyStore_->mergeEntries();
+        for (std::vector<std::string>::const_iterator i = entries.begin();
+            i < entries.end(); ++i)
+        {
+            readlineLibrary_->addHistory(*i);
+        }
+    }
+
+    //
+    // Members for history search
+    //
+
+    Readline* Readline::historySearchObject_ = NULL;
+
+    void Readline::bindHistorySearch(const std::string& keySequence)
+    {
+        if (readlineLibrary_) {
+            historySearchObject_ = this;
+            readlineLibrary_->bindKeySequence(keySequence,
+                &Readline::historySearch);
+        }
+    }
+
+    int Readline::historySearch(int count, int key)
+    {
+        Readline* self = historySearchObject_;
+        if (self == NULL || ! self->readlineLibrary_ ||
+            ! self->historyStore_)
+        {
+            return 0;
+        }
+
+        // Start a new search unless the line is the last match shown
+        std::string line = self->readlineLibrary_->lineBuffer();
+        if (self->searchMatch_.empty() || line != self->searchMatch_) {
+            self->searchQuery_ = line;
+            self->searchMatch_.clear();
+            self->searchPosition_ = static_cast<std::size_t>(-1);
+        }
+
+        const cli::history::HistoryIndex& index =
+            self->historyStore_->index();
+        while (true) {
+            std::vector<std::size_t> found = index.search(self->searchQuery_,
+                cli::history::HistoryIndex::MatchType::SUBSTRING, 1,
+                self->searchPosition_);
+            if (found.empty()) {
+                return 0;
+            }
+
+            self->searchPosition_ = found.front();
+            const std::string& entry = index.entry(found.front());
+            if (entry != line) {
+                self->searchMatch_ = entry;
+                self->readlineLibrary_->replaceLine(entry);
+                return 0;
+            }
+        }
+    }
 }}
@@ -0,0 +1,115 @@
+/*
+ * script.cpp - Support for interpreting script files
+ *
+ *   Copyright 2010-2016 Jesús Torres <jmtorres@ull.es>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cerrno>
+#include <string>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cli/script.hpp>
+
+namespace cli { namespace script
+{
+    //
+    // Class MappedFile
+    //
+
+    MappedFile::MappedFile(const std::string& fileName)
+        : data_(NULL), size_(0), isMapped_(false)
+    {
+        int fd = ::open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            throw std::system_error(errno, std::system_category(),
+                "cannot open '" + fileName + "'");
+        }
+
+        struct stat status;
+        if (::fstat(fd, &status) == -1) {
+            int error = errno;
+            ::close(fd);
+            throw std::system_error(error, std::system_category(),
+                "cannot stat '" + fileName + "'");
+        }
+
+        // The size of anything but regular files is meaningless
+        if (! S_ISREG(status.st_mode)) {
+            try {
+                read(fd, fileName);
+            }
+            catch (...) {
+                ::close(fd);
+                throw;
+            }
+            ::close(fd);
+            return;
+        }
+
+        // Empty files can not be mapped
+        size_ = status.st_size;
+        if (size_ > 0) {
+            void* data = ::mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED) {
+                int error = errno;
+                ::close(fd);
+                throw std::system_error(error, std::system_category(),
+                    "cannot map '" + fileName + "'");
+            }
+            ::madvise(data, size_, MADV_SEQUENTIAL);
+            data_ = static_cast<const char*>(data);
+            isMapped_ = true;
+        }
+        ::close(fd);
+    }
+
+    MappedFile::~MappedFile()
+    {
+        if (isMapped_) {
+            ::munmap(const_cast<char*>(data_), size_);
+        }
+    }
+
+    void MappedFile::read(int fd, const std::string& fileName)
+    {
+        const std::size_t BLOCK_SIZE = 64 * 1024;
+
+        while (true) {
+            std::size_t size = buffer_.size();
+            buffer_.resize(size + BLOCK_SIZE);
+            ssize_t count = ::read(fd, &buffer_[size], BLOCK_SIZE);
+            if (count == -1 && errno == EINTR) {
+                buffer_.resize(size);
+                continue;
+            }
+            else if (count == -1) {
+                throw std::system_error(errno, std::system_category(),
+                    "cannot read '" + fileName + "'");
+            }
+            buffer_.resize(size + count);
+            if (count == 0) {
+                break;
+            }
+        }
+
+        data_ = buffer_.data();
+        size_ = buffer_.size();
+    }
+}}
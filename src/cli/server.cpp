@@ -0,0 +1,340 @@
+/*
+ * server.cpp - Server of shell interpreter sessions over a local socket
+ *
+ *   Copyright 2010-2016 Jesús Torres <jmtorres@ull.es>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <thread>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cli/server.hpp>
+
+namespace cli { namespace server
+{
+    //
+    // Class Session
+    //
+
+    struct Session
+    {
+        int fd;
+        std::istringstream in;
+        std::ostringstream out;
+        cli::ShellInterpreter interpreter;
+        std::string pendingOutput;
+        bool isFinished;
+
+        Session(int fd)
+            : fd(fd),
+              interpreter(in, out, out, false),
+              isFinished(false)
+        {}
+    };
+
+    //
+    // Class ShellServer
+    //
+
+    ShellServer::ShellServer(const std::string& socketName, unsigned workers)
+        : socketName_(socketName),
+          listenFd_(-1),
+          epollFd_(-1),
+          stopFd_(-1),
+          workerCount_(workers > 0 ? workers : 1)
+    {
+        struct sockaddr_un address;
+        std::memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (socketName.size() >= sizeof(address.sun_path)) {
+            throw std::system_error(ENAMETOOLONG, std::system_category(),
+                "invalid socket name '" + socketName + "'");
+        }
+        std::strcpy(address.sun_path, socketName.c_str());
+
+        std::string operation;
+        try {
+            operation = "cannot create socket";
+            listenFd_ = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK |
+                SOCK_CLOEXEC, 0);
+            if (listenFd_ == -1) throw errno;
+
+            operation = "cannot bind socket to '" + socketName + "'";
+            ::unlink(socketName.c_str());
+            if (::bind(listenFd_, reinterpret_cast<struct sockaddr*>(
+                &address), sizeof(address)) == -1) throw errno;
+
+            operation = "cannot listen on '" + socketName + "'";
+            if (::listen(listenFd_, SOMAXCONN) == -1) throw errno;
+
+            operation = "cannot create epoll instance";
+            epollFd_ = ::epoll_create1(EPOLL_CLOEXEC);
+            if (epollFd_ == -1) throw errno;
+
+            // Both descriptors are identified by the address of the member
+            // storing them. The stop event is level-triggered, so it wakes
+            // up every worker.
+            operation = "cannot create stop event";
+            stopFd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (stopFd_ == -1) throw errno;
+
+            struct epoll_event event;
+            event.events = EPOLLIN;
+            event.data.ptr = &stopFd_;
+            if (::epoll_ctl(epollFd_, EPOLL_CTL_ADD, stopFd_, &event) == -1)
+                throw errno;
+
+            event.events = EPOLLIN | EPOLLONESHOT;
+            event.data.ptr = &listenFd_;
+            if (::epoll_ctl(epollFd_, EPOLL_CTL_ADD, listenFd_, &event) == -1)
+                throw errno;
+        }
+        catch (int error) {
+            if (stopFd_ != -1) ::close(stopFd_);
+            if (epollFd_ != -1) ::close(epollFd_);
+            if (listenFd_ != -1) ::close(listenFd_);
+            throw std::system_error(error, std::system_category(), operation);
+        }
+    }
+
+    ShellServer::~ShellServer()
+    {
+        stop();
+        for (std::vector<std::thread>::iterator i = workers_.begin();
+            i < workers_.end(); ++i)
+        {
+            i->join();
+        }
+
+        for (std::unordered_map<int, std::unique_ptr<Session> >::iterator
+            i = sessions_.begin(); i != sessions_.end(); ++i)
+        {
+            ::close(i->first);
+        }
+        sessions_.clear();
+
+        ::close(stopFd_);
+        ::close(epollFd_);
+        ::close(listenFd_);
+        ::unlink(socketName_.c_str());
+    }
+
+    void ShellServer::start()
+    {
+        if (! workers_.empty()) {
+            return;
+        }
+        for (unsigned i = 0; i < workerCount_; ++i) {
+            workers_.push_back(std::thread(&ShellServer::worker, this));
+        }
+    }
+
+    //
+    // It only asks the workers to finish, so it can be invoked from the
+    // commands. They are waited for in run() or in the destructor.
+    //
+
+    void ShellServer::stop()
+    {
+        std::uint64_t value = 1;
+        ssize_t count = ::write(stopFd_, &value, sizeof(value));
+        (void)count;
+    }
+
+    void ShellServer::run()
+    {
+        start();
+        for (std::vector<std::thread>::iterator i = workers_.begin();
+            i < workers_.end(); ++i)
+        {
+            i->join();
+        }
+        workers_.clear();
+    }
+
+    std::size_t ShellServer::sessionCount() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return sessions_.size();
+    }
+
+    void ShellServer::worker()
+    {
+        while (true) {
+            struct epoll_event event;
+            int count = ::epoll_wait(epollFd_, &event, 1, -1);
+            if (count == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return;
+            }
+            else if (count == 0) {
+                continue;
+            }
+
+            if (event.data.ptr == &stopFd_) {
+                return;
+            }
+            else if (event.data.ptr == &listenFd_) {
+                acceptSessions();
+
+                // No more sessions could be accepted, so run() returns
+                // instead of waiting for ever
+                event.events = EPOLLIN | EPOLLONESHOT;
+                if (::epoll_ctl(epollFd_, EPOLL_CTL_MOD, listenFd_,
+                    &event) == -1)
+                {
+                    stop();
+                }
+                continue;
+            }
+
+            // EPOLLONESHOT guarantees that no other worker is handling
+            // this session until it is rearmed
+            Session& session = *static_cast<Session*>(event.data.ptr);
+            bool isOpen = (event.events & EPOLLERR) == 0;
+            if (isOpen && (event.events & EPOLLOUT)) {
+                isOpen = writeSession(session);
+            }
+            if (isOpen && session.pendingOutput.empty()) {
+                if (session.isFinished) {
+                    isOpen = false;
+                }
+                else if (event.events & (EPOLLIN | EPOLLHUP | EPOLLRDHUP)) {
+                    isOpen = readSession(session);
+                }
+            }
+
+            if (! isOpen || (session.isFinished &&
+                session.pendingOutput.empty()))
+            {
+                closeSession(session);
+                continue;
+            }
+
+            // Stop reading until the client accepts the pending output
+            // The session would never be handled again if it is not
+            // rearmed, so it is closed
+            event.events = EPOLLONESHOT | (session.pendingOutput.empty() ?
+                (EPOLLIN | EPOLLRDHUP) : EPOLLOUT);
+            if (::epoll_ctl(epollFd_, EPOLL_CTL_MOD, session.fd,
+                &event) == -1)
+            {
+                closeSession(session);
+            }
+        }
+    }
+
+    void ShellServer::acceptSessions()
+    {
+        while (true) {
+            int fd = ::accept4(listenFd_, NULL, NULL,
+                SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd == -1) {
+                if (errno == EINTR || errno == ECONNABORTED) {
+                    continue;
+                }
+                return;
+            }
+
+            // An exception would end the worker, so the session is just
+            // dropped
+            std::unique_ptr<Session> session;
+            try {
+                session.reset(new Session(fd));
+                if (onNewSession) {
+                    onNewSession.call(session->interpreter);
+                }
+            }
+            catch (const std::exception&) {
+                ::close(fd);
+                continue;
+            }
+
+            struct epoll_event event;
+            event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+            event.data.ptr = session.get();
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                sessions_[fd] = std::move(session);
+            }
+            if (::epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &event) == -1) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                sessions_.erase(fd);
+                ::close(fd);
+            }
+        }
+    }
+
+    bool ShellServer::readSession(Session& session)
+    {
+        try {
+            session.isFinished = session.interpreter.onReadable(session.fd);
+        }
+        catch (const std::exception&) {
+            return false;
+        }
+
+        session.pendingOutput += session.out.str();
+        session.out.str(std::string());
+        return writeSession(session);
+    }
+
+    bool ShellServer::writeSession(Session& session)
+    {
+        std::string::size_type written = 0;
+        while (written < session.pendingOutput.size()) {
+            ssize_t count = ::send(session.fd,
+                session.pendingOutput.data() + written,
+                session.pendingOutput.size() - written, MSG_NOSIGNAL);
+            if (count == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    break;
+                }
+                return false;
+            }
+            written += count;
+        }
+        session.pendingOutput.erase(0, written);
+        return true;
+    }
+
+    void ShellServer::closeSession(Session& session)
+    {
+        int fd = session.fd;
+        ::epoll_ctl(epollFd_, EPOLL_CTL_DEL, fd, NULL);
+        ::close(fd);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        sessions_.erase(fd);
+    }
+}}
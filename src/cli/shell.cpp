@@ -18,6 +18,16 @@
 
 //#define BOOST_SPIRIT_DEBUG
 
+#include <atomic>
+#include <cctype>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <signal.h>
+
 #include <boost/fusion/adapted/struct/adapt_struct.hpp>
 #include <boost/fusion/include/adapt_struct.hpp>
 #include <boost/shared_ptr.hpp>
@@ -49,6 +59,13 @@ BOOST_FUSION_ADAPT_STRUCT(
     (std::string, argument)
 )
 
+BOOST_FUSION_ADAPT_STRUCT(
+    cli::parser::shellparser::Word,
+    (std::string, text)
+    (bool, isPattern)
+    (glob::QuotedRanges, quoted)
+)
+
 BOOST_FUSION_ADAPT_STRUCT(
     cli::parser::shellparser::Arguments,
     (std::vector<cli::parser::shellparser::VariableAssignment>, variables)
@@ -107,6 +124,7 @@ namespace cli { namespace parser { namespace shellparser
         dereference = '$';
         special %= dereference | redirectors | terminators | pipe;
         escape %= '\\' > character;
+        patternCharacter %= char_("*?[{~");
 
         name %= char_("a-zA-Z") >> *char_("a-zA-Z0-9");
         variable =
@@ -128,14 +146,27 @@ namespace cli { namespace parser { namespace shellparser
             (char_ - '"')               [push_back(_val, _1)]
         ) > '"';
 
+        // Values of variables are globbed, as the shells do
         word = +(
-            variable                    [_val += _1]          |
-            quotedString
-                [_val += phoenix::bind(&ShellParser::globEscape, _1)]  |
-            doubleQuotedString
-                [_val += phoenix::bind(&ShellParser::globEscape, _1)]  |
-            escape                      [push_back(_val, _1)] |
-            (char_ - space - special)   [push_back(_val, _1)]
+            variable [
+                at_c<0>(_val) += _1,
+                at_c<1>(_val) = at_c<1>(_val) ||
+                    phoenix::bind(&ShellParser::hasPatternCharacters, _1)
+            ] |
+            quotedString [
+                phoenix::bind(&ShellParser::appendQuoted, _val, _1)
+            ] |
+            doubleQuotedString [
+                phoenix::bind(&ShellParser::appendQuoted, _val, _1)
+            ] |
+            escape [
+                phoenix::bind(&ShellParser::appendQuotedCharacter, _val, _1)
+            ] |
+            patternCharacter [
+                push_back(at_c<0>(_val), _1),
+                at_c<1>(_val) = true
+            ] |
+            (char_ - space - special)   [push_back(at_c<0>(_val), _1)]
         );
 
         expandedWord = word
@@ -196,11 +227,113 @@ namespace cli { namespace parser { namespace shellparser
         BOOST_SPIRIT_DEBUG_NODE(start);
     }
 
+    template <typename Iterator>
+    void ShellParser<Iterator>::appendQuoted(Word& word,
+        const std::string& text)
+    {
+        std::size_t begin = word.text.size();
+        word.text += text;
+        if (text.empty()) {
+            return;
+        }
+
+        // Contiguous quoted strings are kept as a single range
+        if (! word.quoted.empty() && word.quoted.back().second == begin) {
+            word.quoted.back().second = word.text.size();
+        }
+        else {
+            word.quoted.push_back(std::make_pair(begin, word.text.size()));
+        }
+    }
+
     //
     // Explicit instantiations of ShellParser class
     //
 
     template class ShellParser<std::string::const_iterator>;
+
+    //
+    // Class LineContinuation
+    //
+
+    LineContinuation::LineContinuation()
+        : quote_(NO_QUOTE),
+          isPending_(false)
+    {}
+
+    bool LineContinuation::append(std::string& line)
+    {
+        // Escapes are only recognized outside quoted strings, as the parser
+        // does. The pipe must be the last character which is not a space.
+        bool isEscaped = false;
+        bool isPiped = false;
+        for (std::string::const_iterator i = line.begin(); i < line.end();
+            ++i)
+        {
+            if (quote_ == SINGLE_QUOTE) {
+                if (*i == '\'') {
+                    quote_ = NO_QUOTE;
+                }
+            }
+            else if (quote_ == DOUBLE_QUOTE) {
+                if (*i == '"') {
+                    quote_ = NO_QUOTE;
+                }
+            }
+            else if (isEscaped) {
+                isEscaped = false;
+                isPiped = false;
+            }
+            else if (*i == '\\') {
+                isEscaped = true;
+            }
+            else if (*i == '\'') {
+                quote_ = SINGLE_QUOTE;
+            }
+            else if (*i == '"') {
+                quote_ = DOUBLE_QUOTE;
+            }
+            else if (*i == '|') {
+                isPiped = true;
+            }
+            else if (! std::isspace(static_cast<unsigned char>(*i))) {
+                isPiped = false;
+            }
+        }
+
+        if (quote_ != NO_QUOTE) {
+            command_ += line;
+            command_ += '\n';
+        }
+        else if (isEscaped) {
+            command_.append(line, 0, line.size() - 1);
+        }
+        else if (isPiped) {
+            command_ += line;
+            command_ += ' ';
+        }
+        else {
+            // Most commands fit in one line, so they are not copied
+            if (isPending_) {
+                command_ += line;
+                line.swap(command_);
+                command_.clear();
+                isPending_ = false;
+            }
+            return true;
+        }
+
+        isPending_ = true;
+        return false;
+    }
+
+    void LineContinuation::flush(std::string& line)
+    {
+        line.swap(command_);
+        command_.clear();
+        quote_ = NO_QUOTE;
+        isPending_ = false;
+    }
 }}}
 
 namespace cli
@@ -208,21 +341,194 @@ namespace cli
     //
     // Class ShellInterpreter
     //
+
+    namespace
+    {
+        //
+        // Tell if a word generated by the brace expansion has to be
+        // globbed, because it has unquoted metacharacters
+        //
+
+        bool isPattern(const glob::BraceExpansion::Word& word)
+        {
+            std::size_t begin = 0;
+            for (glob::QuotedRanges::const_iterator i = word.quoted.begin();
+                i <= word.quoted.end(); ++i)
+            {
+                std::size_t end = (i == word.quoted.end()) ?
+                    word.text.size() : i->first;
+                if (word.text.find_first_of("*?[\\", begin) < end ||
+                    (begin == 0 && end > 0 && word.text[0] == '~'))
+                {
+                    return true;
+                }
+                if (i != word.quoted.end()) {
+                    begin = i->second;
+                }
+            }
+            return false;
+        }
+
+        //
+        // Budget of the pathname expansion, so patterns like '/**/*' do not
+        // walk the whole file system
+        //
+
+        glob::GlobOptions makeGlobOptions(glob::DirectoryCache& directoryCache)
+        {
+            glob::GlobOptions options;
+            options.directoryCache = &directoryCache;
+            options.maxEntriesVisited = 10000000;
+            options.maxPathNames = 1000000;
+            return options;
+        }
+
+        //
+        // Tokens of the pathname expansions in progress, cancelled by the
+        // SIGINT handler. Expansions run by several threads, or by several
+        // interpreters, register their own tokens. The handler is only
+        // installed while some token is registered.
+        //
+
+        const std::size_t MAX_INTERRUPTIBLE_EXPANSIONS = 64;
+
+        std::atomic<glob::CancellationToken*>
+            interruptibleTokens[MAX_INTERRUPTIBLE_EXPANSIONS];
+        std::atomic<unsigned> runningInterruptHandlers(0);
+
+        // Protected by interruptMutex
+        std::mutex interruptMutex;
+        unsigned interruptGuards = 0;
+        struct sigaction oldInterruptAction;
+        bool isInterruptHandlerInstalled = false;
+
+        extern "C" void cancelExpansions(int)
+        {
+            ++runningInterruptHandlers;
+            for (std::size_t i = 0; i < MAX_INTERRUPTIBLE_EXPANSIONS; ++i) {
+                glob::CancellationToken* token = interruptibleTokens[i];
+                if (token != NULL) {
+                    token->cancel();
+                }
+            }
+            --runningInterruptHandlers;
+        }
+
+        //
+        // Class InterruptGuard
+        //
+        // Register a token to be cancelled with SIGINT while it lives. If
+        // there are too many expansions at the same time, the token is not
+        // registered and the expansion can not be interrupted.
+        //
+
+        class InterruptGuard
+        {
+            public:
+                InterruptGuard(glob::CancellationToken& token)
+                    : slot_(MAX_INTERRUPTIBLE_EXPANSIONS)
+                {
+                    {
+                        std::lock_guard<std::mutex> lock(interruptMutex);
+                        if (interruptGuards++ == 0) {
+                            struct sigaction action;
+                            action.sa_handler = &cancelExpansions;
+                            sigemptyset(&action.sa_mask);
+                            action.sa_flags = 0;
+                            isInterruptHandlerInstalled = ::sigaction(SIGINT,
+                                &action, &oldInterruptAction) == 0;
+                        }
+                    }
+
+                    for (std::size_t i = 0;
+                        i < MAX_INTERRUPTIBLE_EXPANSIONS; ++i)
+                    {
+                        glob::CancellationToken* empty = NULL;
+                        if (interruptibleTokens[i].compare_exchange_strong(
+                            empty, &token))
+                        {
+                            slot_ = i;
+                            break;
+                        }
+                    }
+                }
+
+                ~InterruptGuard()
+                {
+                    // The token must not be destroyed while a handler
+                    // could be cancelling it
+                    if (slot_ < MAX_INTERRUPTIBLE_EXPANSIONS) {
+                        interruptibleTokens[slot_] = NULL;
+                        while (runningInterruptHandlers != 0) {
+                            std::this_thread::yield();
+                        }
+                    }
+
+                    std::lock_guard<std::mutex> lock(interruptMutex);
+                    if (--interruptGuards == 0 &&
+                        isInterruptHandlerInstalled)
+                    {
+                        ::sigaction(SIGINT, &oldInterruptAction, NULL);
+                        isInterruptHandlerInstalled = false;
+                    }
+                }
+
+                InterruptGuard(const InterruptGuard&) = delete;
+                InterruptGuard& operator=(const InterruptGuard&) = delete;
+
+            private:
+                std::size_t slot_;
+        };
+    }
     // Interpreter which uses ShellParser to parse the command line, emulating
     // a very simple shell.
     //
 
     ShellInterpreter::ShellInterpreter(bool useReadline)
         : BaseType(boost::shared_ptr<SpiritGrammarType>(
-            new SpiritGrammarType(*this)), useReadline)
+            new SpiritGrammarType(*this)), useReadline),
+          globOptions_(makeGlobOptions(directoryCache())),
+          braceExpansionLimit_(glob::BraceExpansion::DEFAULT_LIMIT)
     {}
 
     ShellInterpreter::ShellInterpreter(std::istream& in, std::ostream& out,
         std::ostream& err, bool useReadline)
         : BaseType(boost::shared_ptr<SpiritGrammarType>(
-            new SpiritGrammarType(*this)), in, out, err, useReadline)
+            new SpiritGrammarType(*this)), in, out, err, useReadline),
+          globOptions_(makeGlobOptions(directoryCache())),
+          braceExpansionLimit_(glob::BraceExpansion::DEFAULT_LIMIT)
     {}
 
+    glob::DirectoryCache& ShellInterpreter::directoryCache()
+    {
+        static glob::DirectoryCache directoryCache;
+        return directoryCache;
+    }
+
+    bool ShellInterpreter::joinLine(std::string& line, bool isLastLine)
+    {
+        if (lineContinuation_.append(line)) {
+            return true;
+        }
+        else if (isLastLine) {
+            // The parser will report what is missing
+            lineContinuation_.flush(line);
+            return true;
+        }
+        return false;
+    }
+
+    bool ShellInterpreter::isParseDeferred(const std::string& line) const
+    {
+        // Variables and path names are expanded while parsing, and they
+        // can be changed by the previous commands
+        if (onPathnameExpansion) {
+            return true;
+        }
+        return line.find_first_of(onVariableLookup ? "$*?[~" : "*?[~") !=
+            std::string::npos;
+    }
+
     std::string ShellInterpreter::variableLookup(const std::string& name)
     {
         return onVariableLookup ?
@@ -230,35 +536,113 @@ namespace cli
     }
 
     std::vector<std::string> ShellInterpreter::pathnameExpansion(
-        const std::string& pattern)
+        const shellparser::Word& word)
     {
+        using namespace glob;
+
+        // The callback gets the quoted characters escaped
         if (onPathnameExpansion) {
+            std::string pattern;
+            std::size_t begin = 0;
+            for (QuotedRanges::const_iterator i = word.quoted.begin();
+                i < word.quoted.end(); ++i)
+            {
+                pattern.append(word.text, begin, i->first - begin);
+                pattern += Glob::escape(word.text.substr(i->first,
+                    i->second - i->first));
+                begin = i->second;
+            }
+            pattern.append(word.text, begin, std::string::npos);
             return onPathnameExpansion.call(pattern);
         }
 
-        using namespace glob;
+        // Words without metacharacters would match themselves, so the file
+        // system is not accessed
+        if (! word.isPattern) {
+            return std::vector<std::string>(1, word.text);
+        }
+
+        // Without a token of their own, the expansions are cancelled with
+        // Ctrl-C
+        GlobOptions options = globOptions_;
+        CancellationToken interruptToken;
+        std::unique_ptr<InterruptGuard> interruptGuard;
+        if (options.cancellationToken == NULL) {
+            interruptGuard.reset(new InterruptGuard(interruptToken));
+            options.cancellationToken = &interruptToken;
+        }
+
+        // The words generated by braces share the limits of the expansion
+        GlobBudget budget;
+        if (options.budget == NULL) {
+            options.budget = &budget;
+        }
+
+        // Braces are expanded before globbing every word generated, as
+        // bash does. The word is left as it is if there are too many.
+        std::vector<std::string> pathNames;
+        try {
+            BraceExpansion words(word.text, word.quoted,
+                braceExpansionLimit_);
+            for (BraceExpansion::iterator i = words.begin();
+                i != words.end(); ++i)
+            {
+                if (! isPattern(*i)) {
+                    pathNames.push_back(i->text);
+                    continue;
+                }
 
 #if defined(_GNU_SOURCE)
-        Glob glob(pattern, GlobFlags::EXPAND_BRACE_EXPRESSIONS |
-            GlobFlags::NO_PATH_NAMES_CHECK | GlobFlags::EXPAND_TILDE);
+                Glob glob(i->text, i->quoted,
+                    GlobFlags::NO_PATH_NAMES_CHECK | GlobFlags::EXPAND_TILDE |
+                    GlobFlags::EXPAND_RECURSIVE_WILDCARD, options);
 #else
-        Glob glob(pattern, GlobFlags::NO_PATH_NAMES_CHECK);
+                Glob glob(i->text, i->quoted, GlobFlags::NO_PATH_NAMES_CHECK |
+                    GlobFlags::EXPAND_RECURSIVE_WILDCARD, options);
 #endif /* _GNU_SOURCE */
 
-        Glob::ErrorsType errors = glob.errors();
-        for (Glob::ErrorsType::const_iterator i = errors.begin();
-            i < errors.end(); ++i)
-        {
-            std::cerr
+                Glob::ErrorsType errors = glob.errors();
+                for (Glob::ErrorsType::const_iterator j = errors.begin();
+                    j < errors.end(); ++j)
+                {
+                    // The word is left as it is if the expansion was not
+                    // finished
+                    if (j->second.category() == globCategory()) {
+                        err()
+                            << cli::utility::programShortName()
+                            << ": "
+                            << word.text
+                            << ": "
+                            << j->second.message()
+                            << std::endl;
+                        return std::vector<std::string>(1, word.text);
+                    }
+                    err()
+                        << cli::utility::programShortName()
+                        << ": "
+                        << translate("i/o error at")
+                        << " "
+                        << j->first
+                        << ": "
+                        << j->second.message()
+                        << std::endl;
+                }
+
+                pathNames.insert(pathNames.end(), glob.pathNames().begin(),
+                    glob.pathNames().end());
+            }
+        }
+        catch (const std::system_error& e) {
+            err()
                 << cli::utility::programShortName()
                 << ": "
-                << translate("i/o error at")
+                << translate("brace expansion")
                 << " "
-                << i->first
-                << ": "
-                << i->second.message();
+                << e.what()
+                << std::endl;
+            return std::vector<std::string>(1, word.text);
         }
 
-        return glob;
+        return pathNames;
     }
 }
@@ -19,6 +19,11 @@
 
 #include <algorithm>
 #include <string>
+#include <vector>
+
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/algorithm/string/split.hpp>
+#include <boost/algorithm/string/trim.hpp>
 
 #include <cli/simple.hpp>
 
@@ -41,3 +46,19 @@ namespace cli { namespace parser { namespace simpleparser
         return true;
     }
 }}}
+
+namespace cli { namespace traits
+{
+    std::vector<std::string> ParserTraits<SimpleParser>::commandWords(
+        const std::string& arguments)
+    {
+        std::vector<std::string> words;
+        std::string trimmed = boost::algorithm::trim_copy(arguments);
+        if (! trimmed.empty()) {
+            boost::algorithm::split(words, trimmed,
+                boost::algorithm::is_any_of(" "),
+                boost::algorithm::token_compress_on);
+        }
+        return words;
+    }
+}}
@@ -0,0 +1,250 @@
+/*
+ * suggest.cpp - Suggestions of similar command names
+ *
+ *   Copyright 2010-2016 Jesús Torres <jmtorres@ull.es>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cli/suggest.hpp>
+
+namespace cli { namespace suggest
+{
+    //
+    // Damerau-Levenshtein distance between two words, as computed by the
+    // algorithm of Lowrance and Wagner
+    //
+
+    unsigned editDistance(const std::string& a, const std::string& b)
+    {
+        const std::size_t m = a.size();
+        const std::size_t n = b.size();
+        if (m == 0) return n;
+        if (n == 0) return m;
+
+        // A transposition can refer to any previous row, so the whole
+        // matrix is required. It has an extra row and column of infinite
+        // distances. Command names are short, so it usually fits in a
+        // buffer on the stack.
+        const std::size_t SMALL_WORD_SIZE = 30;
+        const std::size_t width = n + 2;
+        unsigned buffer[(SMALL_WORD_SIZE + 2) * (SMALL_WORD_SIZE + 2)];
+        std::vector<unsigned> heapBuffer;
+        unsigned* distances = buffer;
+        if (m > SMALL_WORD_SIZE || n > SMALL_WORD_SIZE) {
+            heapBuffer.resize((m + 2) * width);
+            distances = &heapBuffer[0];
+        }
+
+        const unsigned infinity = m + n;
+        distances[0] = infinity;
+        for (std::size_t i = 0; i <= m; ++i) {
+            distances[(i + 1) * width] = infinity;
+            distances[(i + 1) * width + 1] = i;
+        }
+        for (std::size_t j = 0; j <= n; ++j) {
+            distances[j + 1] = infinity;
+            distances[width + j + 1] = j;
+        }
+
+        // Last row of 'a' where every character was found
+        std::size_t lastRow[256] = {};
+
+        for (std::size_t i = 1; i <= m; ++i) {
+            // Last column of 'b' which matched a[i - 1]
+            std::size_t lastColumn = 0;
+            for (std::size_t j = 1; j <= n; ++j) {
+                std::size_t k = lastRow[static_cast<unsigned char>(b[j - 1])];
+                std::size_t l = lastColumn;
+                unsigned cost = 1;
+                if (a[i - 1] == b[j - 1]) {
+                    cost = 0;
+                    lastColumn = j;
+                }
+
+                unsigned distance = std::min(std::min(
+                    distances[i * width + j] + cost,
+                    distances[(i + 1) * width + j] + 1),
+                    distances[i * width + j + 1] + 1);
+                unsigned transposition = distances[k * width + l] +
+                    (i - k - 1) + 1 + (j - l - 1);
+                distances[(i + 1) * width + j + 1] =
+                    std::min(distance, transposition);
+            }
+            lastRow[static_cast<unsigned char>(a[i - 1])] = i;
+        }
+        return distances[(m + 1) * width + n + 1];
+    }
+
+    //
+    // Class BKTree
+    //
+
+    const std::chrono::microseconds BKTree::DEFAULT_BUDGET(500);
+
+    void BKTree::insert(const std::string& word)
+    {
+        if (nodes_.empty()) {
+            nodes_.push_back(Node());
+            nodes_.back().word = word;
+            return;
+        }
+
+        std::size_t current = 0;
+        while (true) {
+            unsigned distance = editDistance(word, nodes_[current].word);
+            if (distance == 0) {
+                return;     // Already in the tree
+            }
+
+            std::vector<std::pair<unsigned, std::size_t> >& children =
+                nodes_[current].children;
+            std::vector<std::pair<unsigned, std::size_t> >::const_iterator i;
+            for (i = children.begin(); i < children.end(); ++i) {
+                if (i->first == distance) {
+                    break;
+                }
+            }
+
+            if (i == children.end()) {
+                children.push_back(std::make_pair(distance, nodes_.size()));
+                nodes_.push_back(Node());
+                nodes_.back().word = word;
+                return;
+            }
+            current = i->second;
+        }
+    }
+
+    std::vector<std::string> BKTree::search(const std::string& word,
+        unsigned maxDistance, std::size_t count,
+        std::chrono::microseconds budget) const
+    {
+        // Checking the clock on every node would cost more than comparing
+        // most command names
+        const unsigned NODES_BETWEEN_CLOCK_CHECKS = 32;
+
+        std::vector<std::pair<unsigned, std::string> > found;
+        if (nodes_.empty() || count == 0) {
+            return std::vector<std::string>();
+        }
+
+        std::chrono::steady_clock::time_point deadline =
+            std::chrono::steady_clock::now() + budget;
+
+        std::vector<std::size_t> pending(1, 0);
+        unsigned visited = 0;
+        while (! pending.empty()) {
+            if (++visited % NODES_BETWEEN_CLOCK_CHECKS == 0 &&
+                std::chrono::steady_clock::now() > deadline)
+            {
+                break;
+            }
+
+            const Node& node = nodes_[pending.back()];
+            pending.pop_back();
+
+            unsigned distance = editDistance(word, node.word);
+            if (distance <= maxDistance) {
+                found.push_back(std::make_pair(distance, node.word));
+            }
+
+            // Triangle inequality: only children whose distance to this
+            // node is in [distance - maxDistance, distance + maxDistance]
+            // may be close enough.
+            for (std::vector<std::pair<unsigned, std::size_t> >::
+                const_iterator i = node.children.begin();
+                i < node.children.end(); ++i)
+            {
+                if (i->first + maxDistance >= distance &&
+                    i->first <= distance + maxDistance)
+                {
+                    pending.push_back(i->second);
+                }
+            }
+        }
+
+        std::size_t size = std::min(count, found.size());
+        std::partial_sort(found.begin(), found.begin() + size, found.end());
+
+        std::vector<std::string> words;
+        for (std::size_t i = 0; i < size; ++i) {
+            words.push_back(found[i].second);
+        }
+        return words;
+    }
+
+    //
+    // Names of the executable files in PATH
+    //
+
+    std::vector<std::string> pathExecutables()
+    {
+        std::vector<std::string> names;
+
+        const char* path = std::getenv("PATH");
+        if (path == NULL) {
+            return names;
+        }
+
+        std::string directories(path);
+        std::string::size_type begin = 0;
+        while (begin <= directories.size()) {
+            std::string::size_type end = directories.find(':', begin);
+            if (end == std::string::npos) {
+                end = directories.size();
+            }
+
+            // An empty entry means the current directory
+            std::string directory = (end == begin) ? std::string(".") :
+                directories.substr(begin, end - begin);
+            begin = end + 1;
+
+            DIR* dir = ::opendir(directory.c_str());
+            if (dir == NULL) {
+                continue;
+            }
+
+            int dirFd = ::dirfd(dir);
+            while (struct dirent* entry = ::readdir(dir)) {
+                if (entry->d_name[0] == '.') {
+                    continue;
+                }
+                if (entry->d_type != DT_REG && entry->d_type != DT_LNK &&
+                    entry->d_type != DT_UNKNOWN)
+                {
+                    continue;
+                }
+                if (::faccessat(dirFd, entry->d_name, X_OK, 0) == 0) {
+                    names.push_back(entry->d_name);
+                }
+            }
+            ::closedir(dir);
+        }
+
+        std::sort(names.begin(), names.end());
+        names.erase(std::unique(names.begin(), names.end()), names.end());
+        return names;
+    }
+}}
@@ -16,13 +16,19 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+#include <cstddef>
 #include <cstdlib>
 #include <iostream>
 #include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
 
 #include <cli/callbacks.hpp>
 #include <cli/prettyprint.hpp>
 #include <cli/shell.hpp>
+#include <cli/suggest.hpp>
 #include <cli/utility.hpp>
 
 const char INTRO_TEXT[] = "\x1b[2J\x1b[H"
@@ -31,6 +37,8 @@ const char INTRO_TEXT[] = "\x1b[2J\x1b[H"
 
 const char PROMPT_TEXT[] = "$ ";
 
+const char HISTORY_FILE[] = ".simpleshell_history";
+
 //
 // Function to be invoked by the interpreter to substitute variable names
 // in command-line by its value.
@@ -66,10 +74,81 @@ bool onExit(const std::string& command, cli::ShellArguments const& arguments)
     return true;
 }
 
+//
+// Function to be invoked by the interpreter when the user inputs the
+// 'stats' command.
+//
+// It prints the number of calls, the number of errors and the average
+// latency of every command. The unnamed entry accounts for the commands
+// handled by onOtherCommand().
+//
+
+bool onStats(const cli::ShellInterpreter& interpreter)
+{
+    std::vector<cli::callback::CommandStatistics> statistics =
+        interpreter.onRunCommand.statistics();
+    for (std::vector<cli::callback::CommandStatistics>::const_iterator i =
+        statistics.begin(); i < statistics.end(); ++i)
+    {
+        long long average = i->calls ? i->latency.count() / i->calls : 0;
+        std::cout << (i->command.empty() ? "*" : i->command)
+                  << "\tcalls: " << i->calls
+                  << "\terrors: " << i->errors
+                  << "\taverage: " << average << " ns" << std::endl;
+    }
+
+    const cli::memoize::ResultCache& cache = interpreter.resultCache();
+    std::cout << "cache\thits: " << cache.hits()
+              << "\tmisses: " << cache.misses()
+              << "\tsize: " << cache.size() << " bytes" << std::endl;
+    return false;
+}
+
+//
+// Function to be invoked by the interpreter when the user inputs the
+// 'hsearch' command. It prints the newest history entries containing the
+// text specified.
+//
+
+bool onHistorySearch(const cli::ShellInterpreter& interpreter,
+    const std::string& text)
+{
+    cli::history::HistoryStore* store = interpreter.historyStore();
+    if (store == NULL) {
+        std::cerr << cli::utility::programShortName()
+                  << ": hsearch: history not available" << std::endl;
+        return false;
+    }
+
+    const cli::history::HistoryIndex& index = store->index();
+    std::vector<std::size_t> found = index.search(text);
+    for (std::vector<std::size_t>::const_iterator i = found.begin();
+        i < found.end(); ++i)
+    {
+        std::cout << *i + 1 << '\t' << index.entry(*i) << '\n';
+    }
+    return false;
+}
+
+//
+// Function to be invoked by the interpreter when the user inputs the
+// 'info' command. It has no side effects, so its output is cached.
+//
+
+bool onInfo(const std::string& command, cli::ShellArguments const& arguments)
+{
+    std::cout << "command:   " << command << std::endl;
+    std::cout << "arguments: " << arguments << std::endl;
+    return false;
+}
+
 //
 // Function to be invoked by the interpreter when the user inputs any
 // other command.
 //
+// Commands which are not a path nor an executable file in PATH are
+// reported with the names of similar commands.
+//
 // If this function returns true, the interpreter ends.
 //
 // cli::ShellArguments is an alias of cli::parser::shellparser::Arguments.
@@ -111,16 +190,37 @@ bool onExit(const std::string& command, cli::ShellArguments const& arguments)
 //    };
 //
 
-bool onOtherCommand(const std::string& command,
+bool onOtherCommand(const cli::ShellInterpreter& interpreter,
+    const std::vector<std::string>& executables, const std::string& command,
     cli::ShellArguments const& arguments)
 {
     using namespace cli::prettyprint;
 
-    std::cout << prettyprint;
-    std::cout << "command:   " << command << std::endl;
-    std::cout << "arguments: " << arguments << std::endl;
-    std::cout << "------------------------" << std::endl;
-    std::cout << noprettyprint << std::endl;
+    if (! command.empty() && command.find('/') == std::string::npos &&
+        ! std::binary_search(executables.begin(), executables.end(),
+            command))
+    {
+        std::vector<std::string> suggestions =
+            interpreter.suggestions(command);
+        std::cerr << cli::utility::programShortName() << ": " << command
+                  << ": command not found";
+        for (std::vector<std::string>::const_iterator i =
+            suggestions.begin(); i < suggestions.end(); ++i)
+        {
+            std::cerr << (i == suggestions.begin() ? ", did you mean " :
+                ", ") << *i;
+        }
+        std::cerr << (suggestions.empty() ? "" : "?") << std::endl;
+        return false;
+    }
+
+    // The interpreter flushes the output after the command, so there is no
+    // need to flush at every end-of-line
+    std::cout << prettyprint << buffered;
+    std::cout << "command:   " << command << '\n';
+    std::cout << "arguments: " << arguments << '\n';
+    std::cout << "------------------------" << '\n';
+    std::cout << noprettyprint << '\n';
     return false;
 }
 
@@ -137,6 +237,20 @@ int main(int argc, char** argv)
     interpreter.introText(INTRO_TEXT);
     interpreter.promptText(PROMPT_TEXT);
 
+    // Keep the history in the user home directory. Alt-S searches the line
+    // being edited in the history.
+    const char* home = getenv("HOME");
+    if (home != NULL) {
+        try {
+            interpreter.historyFile(std::string(home) + "/" + HISTORY_FILE);
+            interpreter.historySearchKey("\\es");
+        }
+        catch (const std::system_error& e) {
+            std::cerr << cli::utility::programShortName() << ": "
+                      << e.what() << std::endl;
+        }
+    }
+
     // Set the callback function that will be invoked for variable substitution
     interpreter.onVariableLookup(&onVariableLookup);
 
@@ -145,11 +259,49 @@ int main(int argc, char** argv)
     interpreter.onRunCommand("exit", &onExit);
 
     // Set the callback function that will be invoked when the user inputs
-    // any other command
-    interpreter.onRunCommand(&onOtherCommand);
+    // the 'stats' command. It takes no arguments.
+    interpreter.registerCommand<>("stats",
+        [&interpreter]() { return onStats(interpreter); });
+
+    // Set the callback function that will be invoked when the user inputs
+    // the 'hsearch' command. It takes the text to search for.
+    interpreter.registerCommand<std::string>("hsearch",
+        [&interpreter](const std::string& text) {
+            return onHistorySearch(interpreter, text);
+        });
 
-    // Run the interpreter
-    interpreter.loop();
+    // Set the callback function that will be invoked when the user inputs
+    // the 'info' command. Its results are reused for the same arguments.
+    interpreter.registerCacheableCommand("info", &onInfo);
+
+    // Set the callback function that will be invoked when the user inputs
+    // any other command. The executables in PATH are suggested too when a
+    // command is not found.
+    std::vector<std::string> executables = cli::suggest::pathExecutables();
+    interpreter.onRunCommand.addSuggestions(executables);
+    interpreter.onRunCommand(
+        [&interpreter, &executables](const std::string& command,
+            cli::ShellArguments const& arguments) {
+            return onOtherCommand(interpreter, executables, command,
+                arguments);
+        });
+
+    // Run the script given with '-f file' or read commands from the user
+    if (argc == 3 && std::string(argv[1]) == "-f") {
+        try {
+            // Parsing ahead only pays off if it runs in another core
+            interpreter.prefetchMode(std::thread::hardware_concurrency() > 1);
+            interpreter.runScript(argv[2]);
+        }
+        catch (const std::system_error& e) {
+            std::cerr << cli::utility::programShortName() << ": "
+                      << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    else {
+        interpreter.loop();
+    }
 
     return 0;
 }